@@ -1,5 +1,6 @@
 #include <thread>
 #include <memory>
+#include <algorithm>
 
 #include <CxxPtr/GlibPtr.h>
 
@@ -115,7 +116,10 @@ static std::unique_ptr<rtsp::ClientSession> CreateClientSession (
 
 static void ClientDisconnected(client::WsClient* client) noexcept
 {
-    GSourcePtr timeoutSourcePtr(g_timeout_source_new_seconds(RECONNECT_TIMEOUT));
+    const unsigned reconnectTimeout =
+        std::max<unsigned>(RECONNECT_TIMEOUT, client->retryAfter());
+
+    GSourcePtr timeoutSourcePtr(g_timeout_source_new_seconds(reconnectTimeout));
     GSource* timeoutSource = timeoutSourcePtr.get();
     g_source_set_callback(timeoutSource,
         [] (gpointer userData) -> gboolean {
@@ -0,0 +1,183 @@
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Signalling/Log.h"
+#include "Signalling/WsServer.h"
+#include "Signalling/ServerSession.h"
+
+#include "Client/Log.h"
+#include "Client/WsClient.h"
+
+
+// Compares signalling throughput of WsServer on GLib and native event loops:
+// every client keeps single OPTIONS request in flight.
+// Clients are spread over several threads,
+// so the single threaded server is the bottleneck.
+
+enum {
+    SERVER_PORT = 5554,
+    CLIENTS_COUNT = 200,
+    CLIENT_THREADS = 4,
+    WARMUP_DURATION = 2,
+    MEASURE_DURATION = 10,
+};
+
+static std::atomic<unsigned long long> Responses(0);
+
+
+namespace {
+
+class BenchmarkSession : public rtsp::ClientSession
+{
+public:
+    BenchmarkSession(
+        const std::function<void (const rtsp::Request*) noexcept>& sendRequest,
+        const std::function<void (const rtsp::Response*) noexcept>& sendResponse) noexcept :
+        rtsp::ClientSession(sendRequest, sendResponse) {}
+
+    bool onConnected() noexcept override
+    {
+        requestOptions("*");
+        return true;
+    }
+
+protected:
+    bool onOptionsResponse(
+        const rtsp::Request&,
+        const rtsp::Response&) noexcept override
+    {
+        ++Responses;
+        requestOptions("*");
+        return true;
+    }
+};
+
+}
+
+static std::unique_ptr<WebRTCPeer> CreateServerPeer(const std::string&)
+{
+    return nullptr;
+}
+
+static std::unique_ptr<rtsp::Session> CreateServerSession(
+    const std::function<void (const rtsp::Request*) noexcept>& sendRequest,
+    const std::function<void (const rtsp::Response*) noexcept>& sendResponse) noexcept
+{
+    return std::make_unique<ServerSession>(CreateServerPeer, sendRequest, sendResponse);
+}
+
+static std::unique_ptr<rtsp::Session> CreateClientSession(
+    const std::function<void (const rtsp::Request*) noexcept>& sendRequest,
+    const std::function<void (const rtsp::Response*) noexcept>& sendResponse) noexcept
+{
+    return std::make_unique<BenchmarkSession>(sendRequest, sendResponse);
+}
+
+static void RunClients(GMainLoop* loop, unsigned count)
+{
+    client::Config config {};
+    config.server = "localhost";
+    config.serverPort = SERVER_PORT;
+
+    std::deque<client::WsClient> clients;
+    for(unsigned i = 0; i < count; ++i) {
+        clients.emplace_back(config, loop, CreateClientSession, nullptr);
+        if(clients.back().init())
+            clients.back().connect();
+    }
+
+    g_main_loop_run(loop);
+}
+
+static double Measure(EventLoop eventLoop)
+{
+    signalling::Config config {};
+    config.eventLoop = eventLoop;
+    config.port = SERVER_PORT;
+    config.messagesRate = 0;
+    config.maxMessagesPerIteration = 0;
+    config.maxHandlingTimePerIteration = 0;
+
+    GMainContextPtr serverContextPtr;
+    GMainLoopPtr serverLoopPtr;
+    if(eventLoop == EventLoop::GLib) {
+        serverContextPtr.reset(g_main_context_new());
+        serverLoopPtr.reset(g_main_loop_new(serverContextPtr.get(), FALSE));
+    }
+    GMainLoop* serverLoop = serverLoopPtr.get();
+
+    signalling::WsServer server(config, serverLoop, CreateServerSession);
+
+    std::thread serverThread(
+        [&] () {
+            if(serverContextPtr)
+                g_main_context_push_thread_default(serverContextPtr.get());
+
+            if(!server.init())
+                return;
+
+            if(serverLoop)
+                g_main_loop_run(serverLoop);
+            else
+                server.run();
+        });
+
+    std::vector<GMainLoopPtr> clientLoops;
+    std::vector<std::thread> clientThreads;
+    for(unsigned i = 0; i < CLIENT_THREADS; ++i) {
+        GMainContextPtr clientContextPtr(g_main_context_new());
+        clientLoops.emplace_back(g_main_loop_new(clientContextPtr.get(), FALSE));
+        GMainLoop* clientLoop = clientLoops.back().get();
+
+        const unsigned clientsCount =
+            CLIENTS_COUNT / CLIENT_THREADS +
+            (i < CLIENTS_COUNT % CLIENT_THREADS ? 1 : 0);
+
+        clientThreads.emplace_back(
+            [clientLoop, clientsCount] () {
+                g_main_context_push_thread_default(g_main_loop_get_context(clientLoop));
+                RunClients(clientLoop, clientsCount);
+            });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(WARMUP_DURATION));
+    const unsigned long long startResponses = Responses;
+    std::this_thread::sleep_for(std::chrono::seconds(MEASURE_DURATION));
+    const unsigned long long responses = Responses - startResponses;
+
+    for(const GMainLoopPtr& clientLoop: clientLoops)
+        g_main_loop_quit(clientLoop.get());
+    for(std::thread& clientThread: clientThreads)
+        clientThread.join();
+
+    if(serverLoop)
+        g_main_loop_quit(serverLoop);
+    else
+        server.stop();
+    serverThread.join();
+
+    return static_cast<double>(responses) / MEASURE_DURATION;
+}
+
+int main(int argc, char *argv[])
+{
+    InitWsServerLogger(spdlog::level::warn);
+    InitWsClientLogger(spdlog::level::warn);
+
+    const double glibRate = Measure(EventLoop::GLib);
+    const double nativeRate = Measure(EventLoop::Native);
+
+    spdlog::info(
+        "{} clients on {} threads, OPTIONS round trips per second:",
+        CLIENTS_COUNT, CLIENT_THREADS);
+    spdlog::info("  GLib loop:   {:.0f}", glibRate);
+    spdlog::info("  Native loop: {:.0f}", nativeRate);
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include <thread>
 #include <memory>
+#include <algorithm>
 
 #include <CxxPtr/GlibPtr.h>
 
@@ -7,6 +8,7 @@
 
 #include "TestParse.h"
 #include "TestSerialize.h"
+#include "TestPeerPool.h"
 
 #define ENABLE_SERVER 1
 #define ENABLE_CLIENT 1
@@ -87,7 +89,10 @@ static std::unique_ptr<rtsp::ClientSession> CreateClientSession (
 
 static void ClientDisconnected(client::WsClient* client) noexcept
 {
-    GSourcePtr timeoutSourcePtr(g_timeout_source_new_seconds(RECONNECT_TIMEOUT));
+    const unsigned reconnectTimeout =
+        std::max<unsigned>(RECONNECT_TIMEOUT, client->retryAfter());
+
+    GSourcePtr timeoutSourcePtr(g_timeout_source_new_seconds(reconnectTimeout));
     GSource* timeoutSource = timeoutSourcePtr.get();
     g_source_set_callback(timeoutSource,
         [] (gpointer userData) -> gboolean {
@@ -104,6 +109,7 @@ int main(int argc, char *argv[])
 
     TestParse();
     TestSerialize();
+    TestPeerPool();
 
 #if ENABLE_SERVER
     std::thread signallingThread(
@@ -3,6 +3,7 @@
 #include <cassert>
 
 #include "RtspParser/RtspParser.h"
+#include "RtspParser/RtspSerialize.h"
 
 
 void TestParse()
@@ -189,4 +190,53 @@ void TestParse()
         assert(response.headerFields.size() == 2);
         assert(!response.body.empty());
     }
+
+    {
+        const std::string iceCandidates =
+            "0/candidate:1 1 UDP 2013266431 192.168.1.2 50000 typ host\r\n"
+            "12/candidate:2 1 TCP 1015021823 192.168.1.2 9 typ host tcptype active\r\n";
+        size_t pos = 0;
+        unsigned mlineIndex;
+        rtsp::Token candidate;
+
+        bool success = rtsp::ParseIceCandidate(iceCandidates, &pos, &mlineIndex, &candidate);
+        assert(success);
+        assert(mlineIndex == 0);
+        assert(
+            std::string(candidate.token, candidate.size) ==
+            "candidate:1 1 UDP 2013266431 192.168.1.2 50000 typ host");
+
+        success = rtsp::ParseIceCandidate(iceCandidates, &pos, &mlineIndex, &candidate);
+        assert(success);
+        assert(mlineIndex == 12);
+        assert(pos == iceCandidates.size());
+
+        std::string serialized;
+        rtsp::SerializeIceCandidate(
+            0, "candidate:1 1 UDP 2013266431 192.168.1.2 50000 typ host", &serialized);
+        rtsp::SerializeIceCandidate(
+            12, std::string(candidate.token, candidate.size), &serialized);
+        assert(serialized == iceCandidates);
+    }
+
+    {
+        const char* invalidIceCandidates[] = {
+            "/candidate\r\n",
+            "-1/candidate\r\n",
+            "0/\r\n",
+            "0 candidate\r\n",
+            "0/candidate",
+            "99999999999/candidate\r\n",
+            "10000000000/candidate\r\n",
+        };
+        for(const char* iceCandidate: invalidIceCandidates) {
+            size_t pos = 0;
+            unsigned mlineIndex;
+            rtsp::Token candidate;
+            const bool success =
+                rtsp::ParseIceCandidate(iceCandidate, &pos, &mlineIndex, &candidate);
+            assert(!success);
+            assert(pos == 0);
+        }
+    }
 }
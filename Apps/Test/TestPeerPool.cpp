@@ -0,0 +1,108 @@
+#include "TestPeerPool.h"
+
+#include <cassert>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Signalling/PeerPool.h"
+
+
+namespace {
+
+class FakePeer : public WebRTCPeer
+{
+public:
+    explicit FakePeer(IceServers* preparedWith) :
+        _preparedWith(preparedWith) {}
+
+    void prepare(
+        const IceServers& iceServers,
+        const PreparedCallback& prepared,
+        const IceCandidateCallback& iceCandidate,
+        const EosCallback&) noexcept override
+    {
+        *_preparedWith = iceServers;
+
+        prepared();
+        iceCandidate(0, "candidate:1 1 UDP 2013266431 127.0.0.1 50000 typ host");
+    }
+
+    const std::string& sdp() noexcept override
+        { return _sdp; }
+
+    void setRemoteSdp(const std::string&) noexcept override {}
+    void addIceCandidate(unsigned, const std::string&) noexcept override {}
+    void play() noexcept override {}
+    void stop() noexcept override {}
+
+private:
+    IceServers* _preparedWith;
+    const std::string _sdp = "v=0\r\n";
+};
+
+void IterateUntil(GMainContext* context, const std::function<bool ()>& done)
+{
+    for(unsigned i = 0; i < 100 && !done(); ++i)
+        g_main_context_iteration(context, FALSE);
+
+    assert(done());
+}
+
+}
+
+void TestPeerPool()
+{
+    GMainContextPtr contextPtr(g_main_context_new());
+    GMainContext* context = contextPtr.get();
+    g_main_context_push_thread_default(context);
+
+    {
+        const std::string uri = "rtsp://localhost/bars";
+        const WebRTCPeer::IceServers defaultIceServers = { "stun://stun.l.google.com:19302" };
+        const WebRTCPeer::IceServers otherIceServers = { "stun://localhost:3478" };
+
+        WebRTCPeer::IceServers preparedWith;
+        unsigned created = 0;
+        PeerPool pool(
+            [&preparedWith, &created] (const std::string&) {
+                ++created;
+                return std::make_unique<FakePeer>(&preparedWith);
+            },
+            defaultIceServers);
+
+        pool.addUri(uri, 2, 3);
+        IterateUntil(context, [&pool] () { return pool.stats().pooled == 2; });
+        assert(created == 2);
+        assert(preparedWith == defaultIceServers);
+
+        assert(!pool.takePeer("rtsp://localhost/other", defaultIceServers));
+
+        // peers prepared with other ICE servers are useless for session
+        assert(!pool.takePeer(uri, otherIceServers));
+        assert(pool.stats().misses == 1);
+
+        std::unique_ptr<WebRTCPeer> peer = pool.takePeer(uri, defaultIceServers);
+        assert(peer);
+        assert(pool.stats().hits == 1);
+
+        bool prepared = false;
+        unsigned iceCandidates = 0;
+        peer->prepare(
+            otherIceServers,
+            [&prepared] () { prepared = true; },
+            [&iceCandidates] (unsigned, const std::string&) { ++iceCandidates; },
+            [] () {});
+        // recorded events are replayed on the next loop iteration
+        assert(!prepared);
+        IterateUntil(context, [&prepared, &iceCandidates] () {
+            return prepared && iceCandidates == 1;
+        });
+
+        // taken peer is replaced, and miss with other ICE servers gets its own peer
+        IterateUntil(context, [&pool] () { return pool.stats().pooled == 3; });
+        assert(created == 4);
+        assert(pool.takePeer(uri, otherIceServers));
+    }
+
+    g_main_context_pop_thread_default(context);
+}
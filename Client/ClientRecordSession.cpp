@@ -1,5 +1,9 @@
 #include "ClientRecordSession.h"
 
+#include <CxxPtr/GlibPtr.h>
+
+#include "RtspParser/RtspParser.h"
+#include "RtspParser/RtspSerialize.h"
 #include "RtspSession/StatusCode.h"
 
 #include "Log.h"
@@ -7,6 +11,11 @@
 
 static const auto Log = ClientSessionLog;
 
+enum {
+    // ANNOUNCE answered with 503 and Retry-After
+    MAX_ANNOUNCE_RETRIES = 3,
+};
+
 namespace {
 
 struct IceCandidate {
@@ -22,6 +31,7 @@ struct ClientRecordSession::Private
         ClientRecordSession* owner,
         const std::string& uri,
         std::function<std::unique_ptr<WebRTCPeer> (const std::string& uri)> createPeer);
+    ~Private();
 
     ClientRecordSession* owner;
 
@@ -31,6 +41,10 @@ struct ClientRecordSession::Private
     std::deque<IceCandidate> iceCandidates;
     rtsp::SessionId session;
 
+    unsigned announceRetries = 0;
+    GSourcePtr announceRetrySource;
+
+    bool retryAnnounce(unsigned delay);
     void streamerPrepared();
     void iceCandidate(unsigned, const std::string&);
     void eos();
@@ -44,6 +58,37 @@ ClientRecordSession::Private::Private(
 {
 }
 
+ClientRecordSession::Private::~Private()
+{
+    if(announceRetrySource)
+        g_source_destroy(announceRetrySource.get());
+}
+
+// connection is kept while waiting
+bool ClientRecordSession::Private::retryAnnounce(unsigned delay)
+{
+    if(!delay || announceRetrySource || announceRetries >= MAX_ANNOUNCE_RETRIES)
+        return false;
+
+    ++announceRetries;
+
+    Log()->info("Server is overloaded. Retrying ANNOUNCE in {} seconds...", delay);
+
+    announceRetrySource.reset(g_timeout_source_new_seconds(delay));
+    g_source_set_callback(
+        announceRetrySource.get(),
+        [] (gpointer userData) -> gboolean {
+            ClientRecordSession::Private* p =
+                static_cast<ClientRecordSession::Private*>(userData);
+            p->announceRetrySource.reset();
+            p->owner->requestAnnounce(p->uri, p->streamer->sdp());
+            return G_SOURCE_REMOVE;
+        }, this, nullptr);
+    g_source_attach(announceRetrySource.get(), g_main_context_get_thread_default());
+
+    return true;
+}
+
 void ClientRecordSession::Private::streamerPrepared()
 {
     if(streamer->sdp().empty()) {
@@ -60,11 +105,14 @@ void ClientRecordSession::Private::iceCandidate(
     if(session.empty()) {
         iceCandidates.emplace_back(IceCandidate { mlineIndex, candidate });
     } else {
+        std::string iceCandidate;
+        rtsp::SerializeIceCandidate(mlineIndex, candidate, &iceCandidate);
+
         owner->requestSetup(
             uri,
             "application/x-ice-candidate",
             session,
-            std::to_string(mlineIndex) + "/" + candidate + "\r\n");
+            iceCandidate);
     }
 }
 
@@ -106,6 +154,9 @@ bool ClientRecordSession::onAnnounceResponse(
     const rtsp::Request& request,
     const rtsp::Response& response) noexcept
 {
+    if(response.statusCode == rtsp::StatusCode::SERVICE_UNAVAILABLE)
+        return _p->retryAnnounce(retryAfter());
+
     if(response.statusCode != rtsp::StatusCode::OK)
         return false;
 
@@ -122,10 +173,8 @@ bool ClientRecordSession::onAnnounceResponse(
 
     if(!_p->iceCandidates.empty()) {
         std::string iceCandidates;
-        for(const IceCandidate& c : _p->iceCandidates) {
-            iceCandidates +=
-                std::to_string(c.mlineIndex) + "/" + c.candidate + "\r\n";
-        }
+        for(const IceCandidate& c : _p->iceCandidates)
+            rtsp::SerializeIceCandidate(c.mlineIndex, c.candidate, &iceCandidates);
 
         if(!iceCandidates.empty()) {
             requestSetup(
@@ -197,33 +246,22 @@ bool ClientRecordSession::onSetupRequest(std::unique_ptr<rtsp::Request>& request
 
     const std::string& ice = requestPtr->body;
 
-    const std::string::size_type delimiterPos = ice.find("/");
-    if(delimiterPos == std::string::npos || 0 == delimiterPos)
-        return false;
-
-    const std::string::size_type lineEndPos = ice.find("\r\n", delimiterPos + 1);
-    if(lineEndPos == std::string::npos)
-        return false;
-
-    try{
-        int idx = std::stoi(ice.substr(0, delimiterPos - 0));
-        if(idx < 0)
+    size_t pos = 0;
+    unsigned mlineIndex;
+    rtsp::Token candidateToken;
+    std::string candidate;
+    while(pos < ice.size()) {
+        if(!rtsp::ParseIceCandidate(ice, &pos, &mlineIndex, &candidateToken))
             return false;
 
-        const std::string candidate =
-            ice.substr(delimiterPos + 1, lineEndPos - (delimiterPos + 1));
-
-        if(candidate.empty())
-            return false;
+        candidate.assign(candidateToken.token, candidateToken.size);
 
-        _p->streamer->addIceCandidate(idx, candidate);
+        _p->streamer->addIceCandidate(mlineIndex, candidate);
+    }
 
-        sendOkResponse(requestPtr->cseq, rtsp::RequestSession(*requestPtr));
+    sendOkResponse(requestPtr->cseq, rtsp::RequestSession(*requestPtr));
 
-        return true;
-    } catch(...) {
-        return false;
-    }
+    return true;
 }
 
 
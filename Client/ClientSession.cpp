@@ -1,5 +1,9 @@
 #include "ClientSession.h"
 
+#include <CxxPtr/GlibPtr.h>
+
+#include "RtspParser/RtspParser.h"
+#include "RtspParser/RtspSerialize.h"
 #include "RtspSession/StatusCode.h"
 
 #include "Log.h"
@@ -7,6 +11,11 @@
 
 static const auto Log = ClientSessionLog;
 
+enum {
+    // DESCRIBE answered with 503 and Retry-After
+    MAX_DESCRIBE_RETRIES = 3,
+};
+
 
 struct ClientSession::Private
 {
@@ -14,6 +23,7 @@ struct ClientSession::Private
         ClientSession* owner,
         const std::string& uri,
         std::function<std::unique_ptr<WebRTCPeer> ()> createPeer);
+    ~Private();
 
     ClientSession* owner;
 
@@ -22,8 +32,20 @@ struct ClientSession::Private
     std::unique_ptr<WebRTCPeer> receiver;
     rtsp::SessionId session;
 
+    unsigned iceCoalescingWindow = 0;
+    unsigned maxCoalescedIceCandidates = 0;
+    // not sent yet local ICE candidates
+    std::string iceCandidates;
+    unsigned iceCandidatesCount = 0;
+    GSourcePtr iceFlushSource;
+
+    unsigned describeRetries = 0;
+    GSourcePtr describeRetrySource;
+
+    bool retryDescribe(unsigned delay);
     void receiverPrepared();
     void iceCandidate(unsigned, const std::string&);
+    void flushIceCandidates();
     void eos();
 };
 
@@ -35,6 +57,38 @@ ClientSession::Private::Private(
 {
 }
 
+ClientSession::Private::~Private()
+{
+    if(iceFlushSource)
+        g_source_destroy(iceFlushSource.get());
+    if(describeRetrySource)
+        g_source_destroy(describeRetrySource.get());
+}
+
+// connection is kept while waiting
+bool ClientSession::Private::retryDescribe(unsigned delay)
+{
+    if(!delay || describeRetrySource || describeRetries >= MAX_DESCRIBE_RETRIES)
+        return false;
+
+    ++describeRetries;
+
+    Log()->info("Server is overloaded. Retrying DESCRIBE in {} seconds...", delay);
+
+    describeRetrySource.reset(g_timeout_source_new_seconds(delay));
+    g_source_set_callback(
+        describeRetrySource.get(),
+        [] (gpointer userData) -> gboolean {
+            ClientSession::Private* p = static_cast<ClientSession::Private*>(userData);
+            p->describeRetrySource.reset();
+            p->owner->requestDescribe();
+            return G_SOURCE_REMOVE;
+        }, this, nullptr);
+    g_source_attach(describeRetrySource.get(), g_main_context_get_thread_default());
+
+    return true;
+}
+
 void ClientSession::Private::receiverPrepared()
 {
     if(receiver->sdp().empty()) {
@@ -52,11 +106,48 @@ void ClientSession::Private::receiverPrepared()
 void ClientSession::Private::iceCandidate(
     unsigned mlineIndex, const std::string& candidate)
 {
+    rtsp::SerializeIceCandidate(mlineIndex, candidate, &iceCandidates);
+    ++iceCandidatesCount;
+
+    if(!iceCoalescingWindow ||
+        (maxCoalescedIceCandidates && iceCandidatesCount >= maxCoalescedIceCandidates))
+    {
+        flushIceCandidates();
+        return;
+    }
+
+    if(iceFlushSource)
+        return;
+
+    iceFlushSource.reset(g_timeout_source_new(iceCoalescingWindow));
+    g_source_set_callback(
+        iceFlushSource.get(),
+        [] (gpointer userData) -> gboolean {
+            static_cast<ClientSession::Private*>(userData)->flushIceCandidates();
+            return G_SOURCE_REMOVE;
+        }, this, nullptr);
+    g_source_attach(iceFlushSource.get(), g_main_context_get_thread_default());
+}
+
+void ClientSession::Private::flushIceCandidates()
+{
+    if(iceFlushSource) {
+        g_source_destroy(iceFlushSource.get());
+        iceFlushSource.reset();
+    }
+
+    if(iceCandidates.empty())
+        return;
+
+    std::string candidates;
+    candidates.swap(iceCandidates);
+    iceCandidatesCount = 0;
+
     owner->requestSetup(
         uri,
         "application/x-ice-candidate",
         session,
-        std::to_string(mlineIndex) + "/" + candidate + "\r\n");
+        candidates);
 }
 
 void ClientSession::Private::eos()
@@ -94,6 +185,12 @@ void ClientSession::setUri(const std::string& uri)
     _p->uri = uri;
 }
 
+void ClientSession::setIceCoalescing(unsigned window, unsigned maxCandidates)
+{
+    _p->iceCoalescingWindow = window;
+    _p->maxCoalescedIceCandidates = maxCandidates;
+}
+
 bool ClientSession::onConnected() noexcept
 {
     requestOptions(!_p->uri.empty() ? _p->uri : "*");
@@ -124,6 +221,9 @@ bool ClientSession::onDescribeResponse(
     const rtsp::Request& request,
     const rtsp::Response& response) noexcept
 {
+    if(rtsp::StatusCode::SERVICE_UNAVAILABLE == response.statusCode)
+        return _p->retryDescribe(retryAfter());
+
     if(rtsp::StatusCode::OK != response.statusCode)
         return false;
 
@@ -210,32 +310,21 @@ bool ClientSession::onSetupRequest(std::unique_ptr<rtsp::Request>& requestPtr) n
 
     const std::string& ice = requestPtr->body;
 
-    const std::string::size_type delimiterPos = ice.find("/");
-    if(delimiterPos == std::string::npos || 0 == delimiterPos)
-        return false;
-
-    const std::string::size_type lineEndPos = ice.find("\r\n", delimiterPos + 1);
-    if(lineEndPos == std::string::npos)
-        return false;
-
-    try{
-        int idx = std::stoi(ice.substr(0, delimiterPos - 0));
-        if(idx < 0)
+    size_t pos = 0;
+    unsigned mlineIndex;
+    rtsp::Token candidateToken;
+    std::string candidate;
+    while(pos < ice.size()) {
+        if(!rtsp::ParseIceCandidate(ice, &pos, &mlineIndex, &candidateToken))
             return false;
 
-        const std::string candidate =
-            ice.substr(delimiterPos + 1, lineEndPos - (delimiterPos + 1));
+        candidate.assign(candidateToken.token, candidateToken.size);
 
-        if(candidate.empty())
-            return false;
-
-        _p->receiver->addIceCandidate(idx, candidate);
+        _p->receiver->addIceCandidate(mlineIndex, candidate);
+    }
 
-        sendOkResponse(requestPtr->cseq, rtsp::RequestSession(*requestPtr));
+    sendOkResponse(requestPtr->cseq, rtsp::RequestSession(*requestPtr));
 
-        return true;
-    } catch(...) {
-        return false;
-    }
+    return true;
 }
 
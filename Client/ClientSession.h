@@ -20,6 +20,10 @@ public:
 
     bool onConnected() noexcept override;
 
+    // batches local ICE candidates for window milliseconds (or up to maxCandidates)
+    // into one SETUP request, disabled by default
+    void setIceCoalescing(unsigned window, unsigned maxCandidates = 0);
+
 protected:
     void setUri(const std::string&);
 
@@ -2,13 +2,29 @@
 
 #include <string>
 
+#include "Common/EventLoop.h"
+
 
 namespace client {
 
 struct Config
 {
+    EventLoop eventLoop = EventLoop::GLib;
+
     std::string server;
     unsigned short serverPort;
+
+    // max messages written per LWS_CALLBACK_CLIENT_WRITEABLE
+    unsigned maxMessagesPerWriteable = 16;
+
+    bool permessageDeflate = false;
+
+    // last messages kept to be logged on failure, 0 - disabled
+    unsigned flightRecorderSize = 0;
+    unsigned flightRecorderPayloadSize = 256;
+
+    // interval of timestamped pings used for RTT measurement, 0 - disabled
+    unsigned rttPingInterval = 0; // seconds
 };
 
 }
@@ -2,12 +2,17 @@
 
 #include <deque>
 #include <algorithm>
+#include <chrono>
 
 #include <CxxPtr/libwebsocketsPtr.h>
 
 #include "Helpers/MessageBuffer.h"
 #include "RtspParser/RtspSerialize.h"
 #include "RtspParser/RtspParser.h"
+#include "RtspSession/MessagePriority.h"
+#include "Common/DeflateExtension.h"
+#include "Common/FlightRecorder.h"
+#include "Common/RttEstimator.h"
 
 #include "Log.h"
 
@@ -31,12 +36,30 @@ enum {
 };
 #endif
 
+struct OutgoingMessage
+{
+    MessageBuffer buffer;
+    rtsp::SessionId session;
+};
+
 struct SessionData
 {
+    explicit SessionData(const Config& config) :
+        flightRecorder(config.flightRecorderSize, config.flightRecorderPayloadSize) {}
+
     bool terminateSession = false;
     MessageBuffer incomingMessage;
-    std::deque<MessageBuffer> sendMessages;
+    std::deque<OutgoingMessage> prioritySendMessages;
+    std::deque<OutgoingMessage> sendMessages;
     std::unique_ptr<rtsp::Session > rtspSession;
+    FlightRecorder flightRecorder;
+    RttEstimator rtt;
+    bool pingPending = false;
+
+    bool hasMessagesToSend() const
+        { return !prioritySendMessages.empty() || !sendMessages.empty(); }
+    std::deque<OutgoingMessage>& nextMessages()
+        { return prioritySendMessages.empty() ? sendMessages : prioritySendMessages; }
 };
 
 // Should contain only POD types,
@@ -45,6 +68,7 @@ struct SessionContextData
 {
     lws* wsi;
     SessionData* data;
+    bool deflate; // permessage-deflate accepted by server
 };
 
 const auto Log = WsClientLog;
@@ -65,12 +89,21 @@ struct WsClient::Private
     int wsCallback(lws*, lws_callback_reasons, void* user, void* in, size_t len);
     bool onMessage(SessionContextData*, const MessageBuffer&);
 
-    void send(SessionContextData*, MessageBuffer*);
+    bool write(SessionContextData*, MessageBuffer*);
+    bool writeMessages(SessionContextData*);
+    void send(
+        SessionContextData*,
+        MessageBuffer*,
+        const rtsp::SessionId&,
+        rtsp::MessagePriority);
     void sendRequest(SessionContextData*, const rtsp::Request*);
     void sendResponse(SessionContextData*, const rtsp::Response*);
 
     void connect();
     bool onConnected(SessionContextData*);
+    void onTimer(SessionContextData*);
+
+    void dumpFlightRecorder(SessionContextData*, spdlog::level::level_enum);
 
 
     WsClient *const owner;
@@ -80,9 +113,14 @@ struct WsClient::Private
     Disconnected disconnected;
 
     LwsContextPtr contextPtr;
+    NativeLoop nativeLoop;
 
     lws* connection = nullptr;
+    SessionContextData* connectionContext = nullptr;
     bool connected = false;
+    unsigned retryAfter = 0;
+
+    Stats stats {};
 };
 
 WsClient::Private::Private(
@@ -114,15 +152,13 @@ int WsClient::Private::wsCallback(
             if(!session)
                 return -1;
 
-            scd->data =
-                new SessionData {
-                    .terminateSession = false,
-                    .incomingMessage ={},
-                    .sendMessages = {},
-                    .rtspSession = std::move(session)};
+            scd->data = new SessionData(config);
+            scd->data->rtspSession = std::move(session);
             scd->wsi = wsi;
 
+            connectionContext = scd;
             connected = true;
+            retryAfter = 0;
 
             if(!onConnected(scd))
                 return -1;
@@ -131,22 +167,26 @@ int WsClient::Private::wsCallback(
         }
         case LWS_CALLBACK_CLIENT_RECEIVE_PONG:
             Log()->trace("PONG");
+            if(scd->data)
+                scd->data->rtt.onPong(in, len);
+            break;
+        case LWS_CALLBACK_TIMER:
+            if(scd->data)
+                onTimer(scd);
             break;
         case LWS_CALLBACK_CLIENT_RECEIVE:
             if(scd->data->incomingMessage.onReceive(wsi, in, len)) {
-                if(Log()->level() <= spdlog::level::trace) {
-                    std::string logMessage;
-                    logMessage.reserve(scd->data->incomingMessage.size());
-                    std::remove_copy(
-                        scd->data->incomingMessage.data(),
-                        scd->data->incomingMessage.data() + scd->data->incomingMessage.size(),
-                        std::back_inserter(logMessage), '\r');
-
-                    Log()->trace("-> WsClient: {}", logMessage);
-                }
+                ++stats.receivedMessages;
+
+                scd->data->flightRecorder.record(
+                    FlightRecorder::Direction::Incoming,
+                    scd->data->incomingMessage.data(),
+                    scd->data->incomingMessage.size());
 
-                if(!onMessage(scd, scd->data->incomingMessage))
+                if(!onMessage(scd, scd->data->incomingMessage)) {
+                    dumpFlightRecorder(scd, spdlog::level::warn);
                     return -1;
+                }
 
                 scd->data->incomingMessage.clear();
             }
@@ -156,27 +196,32 @@ int WsClient::Private::wsCallback(
             if(scd->data->terminateSession)
                 return -1;
 
-            if(!scd->data->sendMessages.empty()) {
-                MessageBuffer& buffer = scd->data->sendMessages.front();
-                if(!buffer.writeAsText(wsi)) {
-                    Log()->error("Write failed.");
+            if(scd->data->pingPending) {
+                scd->data->pingPending = false;
+                if(!scd->data->rtt.sendPing(wsi)) {
+                    Log()->error("Ping write failed.");
                     return -1;
                 }
-
-                scd->data->sendMessages.pop_front();
-
-                if(!scd->data->sendMessages.empty())
-                    lws_callback_on_writable(wsi);
             }
 
+            if(!writeMessages(scd))
+                return -1;
+
             break;
         case LWS_CALLBACK_CLIENT_CLOSED:
             Log()->info("Connection to server is closed.");
 
+            if(scd->data && scd->data->rtspSession) {
+                retryAfter = scd->data->rtspSession->retryAfter();
+                if(retryAfter)
+                    Log()->info("Server asked to retry after {} seconds.", retryAfter);
+            }
+
             delete scd->data;
             scd = nullptr;
 
             connection = nullptr;
+            connectionContext = nullptr;
             connected = false;
 
             if(disconnected)
@@ -190,6 +235,7 @@ int WsClient::Private::wsCallback(
             scd = nullptr;
 
             connection = nullptr;
+            connectionContext = nullptr;
             connected = false;
 
             if(disconnected)
@@ -213,6 +259,36 @@ bool WsClient::Private::init()
             return p->wsCallback(wsi, reason, user, in, len);
         };
 
+    auto DeflateCallback =
+        [] (
+            lws_context* context,
+            const lws_extension* extension,
+            lws* wsi,
+            lws_extension_callback_reasons reason,
+            void* user, void* in, size_t len) -> int
+        {
+            Private* p = static_cast<Private*>(lws_context_user(context));
+            SessionContextData* scd = static_cast<SessionContextData*>(lws_wsi_user(wsi));
+
+            // i.e. extension was negotiated
+            if(scd && reason == LWS_EXT_CB_CLIENT_CONSTRUCT)
+                scd->deflate = true;
+
+            return
+                DeflateExtensionCallback(
+                    scd ? &p->stats.deflate : nullptr,
+                    context, extension, wsi, reason, user, in, len);
+        };
+
+    static const lws_extension extensions[] = {
+        {
+            "permessage-deflate",
+            DeflateCallback,
+            "permessage-deflate; client_max_window_bits"
+        },
+        { nullptr, nullptr, nullptr } /* terminator */
+    };
+
     static const lws_protocols protocols[] = {
         {
             "webrtsp",
@@ -230,9 +306,13 @@ bool WsClient::Private::init()
     wsInfo.uid = -1;
     wsInfo.port = CONTEXT_PORT_NO_LISTEN;
     wsInfo.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
-    wsInfo.options |= LWS_SERVER_OPTION_GLIB;
-    wsInfo.foreign_loops = reinterpret_cast<void**>(&loop);
+    if(config.eventLoop == EventLoop::GLib) {
+        wsInfo.options |= LWS_SERVER_OPTION_GLIB;
+        wsInfo.foreign_loops = reinterpret_cast<void**>(&loop);
+    }
     wsInfo.protocols = protocols;
+    if(config.permessageDeflate)
+        wsInfo.extensions = extensions;
 #if LWS_LIBRARY_VERSION_NUMBER < 4000000
     wsInfo.ws_ping_pong_interval = PING_INTERVAL;
 #else
@@ -280,9 +360,35 @@ void WsClient::Private::connect()
 
 bool WsClient::Private::onConnected(SessionContextData* scd)
 {
+    // the first sample is taken right away to be available during session setup
+    if(config.rttPingInterval)
+        onTimer(scd);
+
     return scd->data->rtspSession->onConnected();
 }
 
+void WsClient::Private::onTimer(SessionContextData* scd)
+{
+    scd->data->pingPending = true;
+    lws_callback_on_writable(scd->wsi);
+
+    lws_set_timer_usecs(
+        scd->wsi,
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::seconds(config.rttPingInterval)).count());
+}
+
+void WsClient::Private::dumpFlightRecorder(
+    SessionContextData* scd,
+    spdlog::level::level_enum level)
+{
+    if(Log()->level() > level)
+        return;
+
+    Log()->log(level, "Session with {}:{} history:", config.server, config.serverPort);
+    scd->data->flightRecorder.dump(*Log(), level);
+}
+
 bool WsClient::Private::onMessage(
     SessionContextData* scd,
     const MessageBuffer& message)
@@ -316,11 +422,70 @@ bool WsClient::Private::onMessage(
     return true;
 }
 
-void WsClient::Private::send(SessionContextData* scd, MessageBuffer* message)
+bool WsClient::Private::write(SessionContextData* scd, MessageBuffer* buffer)
+{
+    if(scd->deflate) {
+        ++stats.deflate.deflatedMessages;
+        stats.deflate.deflatedBytes += buffer->size();
+    }
+
+    ++stats.sentMessages;
+
+    return buffer->writeAsText(scd->wsi);
+}
+
+bool WsClient::Private::writeMessages(SessionContextData* scd)
+{
+    SessionData& data = *scd->data;
+
+    unsigned written = 0;
+    while(data.hasMessagesToSend()) {
+        std::deque<OutgoingMessage>& messages = data.nextMessages();
+        MessageBuffer& buffer = messages.front().buffer;
+        if(!write(scd, &buffer)) {
+            Log()->error("Write failed.");
+            dumpFlightRecorder(scd, spdlog::level::warn);
+            return false;
+        }
+
+        messages.pop_front();
+        ++written;
+
+        if(!data.hasMessagesToSend())
+            break;
+
+        if(written >= config.maxMessagesPerWriteable || lws_send_pipe_choked(scd->wsi)) {
+            lws_callback_on_writable(scd->wsi);
+            break;
+        }
+    }
+
+    return true;
+}
+
+void WsClient::Private::send(
+    SessionContextData* scd,
+    MessageBuffer* message,
+    const rtsp::SessionId& session,
+    rtsp::MessagePriority priority)
 {
     assert(!message->empty());
 
-    scd->data->sendMessages.emplace_back(std::move(*message));
+    SessionData& data = *scd->data;
+
+    data.flightRecorder.record(
+        FlightRecorder::Direction::Outgoing,
+        message->data(), message->size());
+
+    const bool prioritize =
+        rtsp::CanPrioritize(priority, session, data.sendMessages);
+
+    std::deque<OutgoingMessage>& messages =
+        prioritize ? data.prioritySendMessages : data.sendMessages;
+    messages.emplace_back(
+        OutgoingMessage {
+            .buffer = std::move(*message),
+            .session = session });
 
     lws_callback_on_writable(scd->wsi);
 }
@@ -331,6 +496,7 @@ void WsClient::Private::sendRequest(
 {
     if(!request) {
         scd->data->terminateSession = true;
+        dumpFlightRecorder(scd, spdlog::level::info);
         lws_callback_on_writable(scd->wsi);
         return;
     }
@@ -340,19 +506,13 @@ void WsClient::Private::sendRequest(
         scd->data->terminateSession = true;
         lws_callback_on_writable(scd->wsi);
     } else {
-        if(Log()->level() <= spdlog::level::trace) {
-            std::string logMessage;
-            logMessage.reserve(serializedRequest.size());
-            std::remove_copy(
-                serializedRequest.begin(),
-                serializedRequest.end(),
-                std::back_inserter(logMessage), '\r');
-            Log()->trace("WsClient -> : {}", logMessage);
-        }
-
         MessageBuffer requestMessage;
         requestMessage.assign(serializedRequest);
-        send(scd, &requestMessage);
+        send(
+            scd,
+            &requestMessage,
+            rtsp::OutgoingRequestSession(*request),
+            rtsp::RequestPriority(*request));
     }
 }
 
@@ -371,19 +531,13 @@ void WsClient::Private::sendResponse(
         scd->data->terminateSession = true;
         lws_callback_on_writable(scd->wsi);
     } else {
-        if(Log()->level() <= spdlog::level::trace) {
-            std::string logMessage;
-            logMessage.reserve(serializedResponse.size());
-            std::remove_copy(
-                serializedResponse.begin(),
-                serializedResponse.end(),
-                std::back_inserter(logMessage), '\r');
-            Log()->trace("WsClient -> : {}", logMessage);
-        }
-
         MessageBuffer responseMessage;
         responseMessage.assign(serializedResponse);
-        send(scd, &responseMessage);
+        send(
+            scd,
+            &responseMessage,
+            rtsp::OutgoingResponseSession(*response),
+            rtsp::ResponsePriority(*response));
     }
 }
 
@@ -410,4 +564,40 @@ void WsClient::connect() noexcept
     _p->connect();
 }
 
+unsigned WsClient::retryAfter() const noexcept
+{
+    return _p->retryAfter;
+}
+
+void WsClient::run() noexcept
+{
+    if(_p->contextPtr)
+        _p->nativeLoop.run(_p->contextPtr.get());
+}
+
+void WsClient::stop() noexcept
+{
+    if(_p->contextPtr)
+        _p->nativeLoop.stop(_p->contextPtr.get());
+}
+
+WsClient::Stats WsClient::stats() const noexcept
+{
+    return _p->stats;
+}
+
+RttEstimator::Estimate WsClient::rtt() const noexcept
+{
+    if(_p->connectionContext && _p->connectionContext->data)
+        return _p->connectionContext->data->rtt.estimate();
+
+    return RttEstimator::Estimate {};
+}
+
+void WsClient::dumpFlightRecorder() const noexcept
+{
+    if(_p->connectionContext && _p->connectionContext->data)
+        _p->dumpFlightRecorder(_p->connectionContext, spdlog::level::info);
+}
+
 }
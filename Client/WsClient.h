@@ -7,6 +7,8 @@
 #include <glib.h>
 
 #include "RtspSession/ClientSession.h"
+#include "Common/RttEstimator.h"
+#include "Common/DeflateExtension.h"
 
 #include "Config.h"
 
@@ -23,6 +25,16 @@ public:
 
     typedef std::function<void () noexcept> Disconnected;
 
+    // accumulated over all connections
+    struct Stats
+    {
+        unsigned long long sentMessages;
+        unsigned long long receivedMessages;
+
+        DeflateStats deflate;
+    };
+
+    // GMainLoop could be nullptr with EventLoop::Native
     WsClient(
         const Config&,
         GMainLoop*,
@@ -31,8 +43,23 @@ public:
     bool init() noexcept;
     ~WsClient();
 
+    // EventLoop::Native only
+    void run() noexcept;
+    void stop() noexcept;
+
     void connect() noexcept;
 
+    // seconds server asked to wait before reconnect
+    // with the last connection, 0 - not requested
+    unsigned retryAfter() const noexcept;
+
+    Stats stats() const noexcept;
+
+    // all zeroes if there is no RTT sample yet
+    RttEstimator::Estimate rtt() const noexcept;
+
+    void dumpFlightRecorder() const noexcept;
+
 private:
     struct Private;
     std::unique_ptr<Private> _p;
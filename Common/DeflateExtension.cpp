@@ -0,0 +1,39 @@
+#include "DeflateExtension.h"
+
+#include <chrono>
+
+
+int DeflateExtensionCallback(
+    DeflateStats* stats,
+    lws_context* context,
+    const lws_extension* extension,
+    lws* wsi,
+    lws_extension_callback_reasons reason,
+    void* user, void* in, size_t len)
+{
+    if(!stats || reason != LWS_EXT_CB_PAYLOAD_TX)
+        return lws_extension_callback_pm_deflate(context, extension, wsi, reason, user, in, len);
+
+    const auto deflateStart = std::chrono::steady_clock::now();
+
+    const int result =
+        lws_extension_callback_pm_deflate(context, extension, wsi, reason, user, in, len);
+
+    stats->deflateTime +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - deflateStart).count();
+
+    // large messages are compressed in several calls
+    if(result >= 0) {
+#if LWS_LIBRARY_VERSION_NUMBER < 4000000
+        const lws_tokens* out = static_cast<const lws_tokens*>(in);
+        stats->compressedBytes += out->token_len;
+#else
+        const lws_ext_pm_deflate_rx_ebufs* buffers =
+            static_cast<const lws_ext_pm_deflate_rx_ebufs*>(in);
+        stats->compressedBytes += buffers->eb_out.len;
+#endif
+    }
+
+    return result;
+}
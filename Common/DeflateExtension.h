@@ -0,0 +1,22 @@
+#pragma once
+
+#include <libwebsockets.h>
+
+
+struct DeflateStats
+{
+    unsigned long long deflatedMessages;
+    unsigned long long deflatedBytes; // before compression
+    unsigned long long compressedBytes; // after compression
+    unsigned long long deflateTime; // microseconds, compression only
+};
+
+// Forwards to libwebsockets permessage-deflate extension,
+// accounting compression time and compressed size to stats (if not nullptr).
+int DeflateExtensionCallback(
+    DeflateStats*,
+    lws_context*,
+    const lws_extension*,
+    lws*,
+    lws_extension_callback_reasons,
+    void* user, void* in, size_t len);
@@ -0,0 +1,33 @@
+#include "EventLoop.h"
+
+
+namespace {
+
+enum {
+#if LWS_LIBRARY_VERSION_NUMBER < 3002000
+    // older libwebsockets polls with the given timeout as is,
+    // so 0 would spin
+    SERVICE_TIMEOUT = 1000, // milliseconds
+#else
+    // ignored, libwebsockets calculates wait time itself
+    SERVICE_TIMEOUT = 0,
+#endif
+};
+
+}
+
+void NativeLoop::run(lws_context* context) noexcept
+{
+    while(!_stopRequested) {
+        if(lws_service(context, SERVICE_TIMEOUT) < 0)
+            break;
+    }
+
+    _stopRequested = false;
+}
+
+void NativeLoop::stop(lws_context* context) noexcept
+{
+    _stopRequested = true;
+    lws_cancel_service(context);
+}
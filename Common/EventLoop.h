@@ -0,0 +1,27 @@
+#pragma once
+
+#include <atomic>
+
+#include <libwebsockets.h>
+
+
+enum class EventLoop {
+    // libwebsockets is driven by foreign GMainLoop,
+    // required if WebRTC peers live on the same loop
+    GLib,
+    // libwebsockets own poll/epoll loop, for signalling only nodes
+    Native,
+};
+
+// Services context with libwebsockets own event loop
+class NativeLoop
+{
+public:
+    // blocks until stop() is called or service failed
+    void run(lws_context*) noexcept;
+    // could be called from any thread
+    void stop(lws_context*) noexcept;
+
+private:
+    std::atomic<bool> _stopRequested { false };
+};
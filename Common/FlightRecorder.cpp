@@ -0,0 +1,78 @@
+#include "FlightRecorder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <string>
+
+
+FlightRecorder::FlightRecorder(unsigned capacity, unsigned maxPayloadSize) noexcept :
+    _capacity(capacity), _maxPayloadSize(maxPayloadSize)
+{
+}
+
+void FlightRecorder::record(Direction direction, const char* data, size_t size) noexcept
+{
+    if(!_capacity)
+        return;
+
+    if(_records.empty()) {
+        try {
+            _records.resize(_capacity);
+            _payloads.resize(static_cast<size_t>(_capacity) * _maxPayloadSize);
+        } catch(...) {
+            _records.clear();
+            _payloads.clear();
+            return;
+        }
+    }
+
+    Record& record = _records[_next];
+    record.time = std::chrono::steady_clock::now();
+    record.direction = direction;
+    record.size = size;
+    record.storedSize = std::min<size_t>(size, _maxPayloadSize);
+
+    memcpy(&_payloads[static_cast<size_t>(_next) * _maxPayloadSize], data, record.storedSize);
+
+    _next = (_next + 1) % _capacity;
+    ++_recorded;
+}
+
+void FlightRecorder::dump(
+    spdlog::logger& log,
+    spdlog::level::level_enum level) const noexcept
+{
+    if(!_recorded)
+        return;
+
+    try {
+        const unsigned count =
+            static_cast<unsigned>(std::min<unsigned long long>(_recorded, _capacity));
+        const auto now = std::chrono::steady_clock::now();
+
+        log.log(level, "Flight recorder: last {} of {} messages", count, _recorded);
+
+        std::string payload;
+        for(unsigned i = 0; i < count; ++i) {
+            const unsigned index = (_next + _capacity - count + i) % _capacity;
+            const Record& record = _records[index];
+            const char* data = &_payloads[static_cast<size_t>(index) * _maxPayloadSize];
+
+            payload.clear();
+            std::remove_copy(
+                data, data + record.storedSize,
+                std::back_inserter(payload), '\r');
+
+            log.log(
+                level,
+                "[-{:.6f}s] {} {} bytes{}: {}",
+                std::chrono::duration<double>(now - record.time).count(),
+                record.direction == Direction::Incoming ? "->" : "<-",
+                record.size,
+                record.storedSize < record.size ? " (truncated)" : "",
+                payload);
+        }
+    } catch(...) {
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <chrono>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+
+// Fixed size ring of last messages of connection,
+// intended to be dumped to log only when something went wrong.
+class FlightRecorder
+{
+public:
+    enum class Direction {
+        Incoming,
+        Outgoing,
+    };
+
+    // capacity == 0 disables recording
+    FlightRecorder(unsigned capacity, unsigned maxPayloadSize) noexcept;
+
+    void record(Direction, const char* data, size_t size) noexcept;
+
+    void dump(spdlog::logger&, spdlog::level::level_enum) const noexcept;
+
+private:
+    struct Record
+    {
+        std::chrono::steady_clock::time_point time;
+        Direction direction;
+        size_t size;
+        size_t storedSize;
+    };
+
+    const unsigned _capacity;
+    const unsigned _maxPayloadSize;
+
+    // allocated on first record
+    std::vector<Record> _records;
+    std::vector<char> _payloads;
+
+    unsigned _next = 0;
+    unsigned long long _recorded = 0;
+};
@@ -0,0 +1,63 @@
+#include "RttEstimator.h"
+
+#include <cstdint>
+#include <cstring>
+
+
+namespace {
+
+enum {
+    // alpha = 1/8, beta = 1/4
+    SMOOTHED_SHIFT = 3,
+    JITTER_SHIFT = 2,
+};
+
+}
+
+bool RttEstimator::sendPing(lws* wsi) noexcept
+{
+    _pingSent = Clock::now();
+    _pingInFlight = true;
+
+    const int64_t timestamp = _pingSent.time_since_epoch().count();
+
+    unsigned char frame[LWS_PRE + sizeof(timestamp)];
+    memcpy(frame + LWS_PRE, &timestamp, sizeof(timestamp));
+
+    return lws_write(wsi, frame + LWS_PRE, sizeof(timestamp), LWS_WRITE_PING) >= 0;
+}
+
+void RttEstimator::onPong(const void* payload, size_t size) noexcept
+{
+    int64_t timestamp;
+    if(!_pingInFlight || size != sizeof(timestamp))
+        return;
+
+    memcpy(&timestamp, payload, sizeof(timestamp));
+    if(timestamp != _pingSent.time_since_epoch().count())
+        return;
+
+    _pingInFlight = false;
+
+    const unsigned long long sample =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - _pingSent).count();
+
+    if(0 == _estimate.samples) {
+        _estimate.smoothed = sample;
+        _estimate.jitter = sample / 2;
+    } else {
+        const unsigned long long deviation =
+            sample > _estimate.smoothed ?
+                sample - _estimate.smoothed :
+                _estimate.smoothed - sample;
+
+        _estimate.jitter =
+            _estimate.jitter - (_estimate.jitter >> JITTER_SHIFT) + (deviation >> JITTER_SHIFT);
+        _estimate.smoothed =
+            _estimate.smoothed - (_estimate.smoothed >> SMOOTHED_SHIFT) + (sample >> SMOOTHED_SHIFT);
+    }
+
+    _estimate.latest = sample;
+    ++_estimate.samples;
+}
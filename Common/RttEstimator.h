@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <chrono>
+
+#include <libwebsockets.h>
+
+
+// Measures WebSocket round trip time with own timestamped pings,
+// smoothed RTT and its variation are calculated as in RFC 6298.
+class RttEstimator
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Estimate
+    {
+        unsigned long long samples;
+        unsigned long long latest; // microseconds
+        unsigned long long smoothed; // microseconds
+        unsigned long long jitter; // microseconds
+    };
+
+    // should be called from writeable callback
+    bool sendPing(lws*) noexcept;
+
+    // pongs not matching the last sent ping
+    // (f.e. replies to libwebsockets keepalive pings) are ignored
+    void onPong(const void* payload, size_t size) noexcept;
+
+    const Estimate& estimate() const noexcept { return _estimate; }
+
+private:
+    Clock::time_point _pingSent;
+    bool _pingInFlight = false;
+
+    Estimate _estimate {};
+};
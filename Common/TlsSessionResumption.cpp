@@ -0,0 +1,296 @@
+#include "TlsSessionResumption.h"
+
+#include <chrono>
+#include <cstring>
+
+#include <libwebsockets.h>
+
+#if defined(LWS_WITH_MBEDTLS)
+#define TLS_SESSION_RESUMPTION_SUPPORTED 0
+#else
+#define TLS_SESSION_RESUMPTION_SUPPORTED 1
+#include <openssl/ssl.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+#endif
+
+
+struct TlsSessionResumption::Private
+{
+    struct TicketKey
+    {
+        unsigned char name[16];
+        unsigned char hmacKey[32];
+        unsigned char aesKey[32];
+    };
+
+    explicit Private(const TlsSessionResumptionConfig& config) :
+        config(config) {}
+
+    bool generateTicketKey(TicketKey*);
+    void rotateTicketKeys();
+    const TicketKey* findTicketKey(const unsigned char* name) const;
+
+#if TLS_SESSION_RESUMPTION_SUPPORTED
+    static int ExDataIndex();
+    static int HandshakeCountedIndex();
+    static Private* FromSsl(const SSL*);
+    static void InfoCallback(const SSL*, int where, int ret);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static int TicketKeyCallback(
+        SSL*,
+        unsigned char* keyName,
+        unsigned char* iv,
+        EVP_CIPHER_CTX*,
+        EVP_MAC_CTX*,
+        int encrypt);
+#else
+    static int TicketKeyCallback(
+        SSL*,
+        unsigned char* keyName,
+        unsigned char* iv,
+        EVP_CIPHER_CTX*,
+        HMAC_CTX*,
+        int encrypt);
+#endif
+#endif
+
+    const TlsSessionResumptionConfig config;
+
+    TicketKey currentTicketKey;
+    TicketKey previousTicketKey;
+    bool hasTicketKey = false;
+    bool hasPreviousTicketKey = false;
+    std::chrono::steady_clock::time_point ticketKeyCreated;
+
+    unsigned long long fullHandshakes = 0;
+    unsigned long long resumedHandshakes = 0;
+};
+
+#if TLS_SESSION_RESUMPTION_SUPPORTED
+
+int TlsSessionResumption::Private::ExDataIndex()
+{
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+// set on SSL when its handshake is accounted
+int TlsSessionResumption::Private::HandshakeCountedIndex()
+{
+    static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+TlsSessionResumption::Private*
+TlsSessionResumption::Private::FromSsl(const SSL* ssl)
+{
+    return static_cast<Private*>(
+        SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ExDataIndex()));
+}
+
+void TlsSessionResumption::Private::InfoCallback(
+    const SSL* ssl,
+    int where,
+    int /*ret*/)
+{
+    if(!(where & SSL_CB_HANDSHAKE_DONE))
+        return;
+
+    Private* p = FromSsl(ssl);
+    if(!p)
+        return;
+
+    // SSL_CB_HANDSHAKE_DONE could be reported more than once per connection
+    // (f.e. on TLS 1.3 post-handshake ticket issuing)
+    if(SSL_get_ex_data(ssl, HandshakeCountedIndex()))
+        return;
+    SSL_set_ex_data(const_cast<SSL*>(ssl), HandshakeCountedIndex(), p);
+
+    if(SSL_session_reused(const_cast<SSL*>(ssl)))
+        ++p->resumedHandshakes;
+    else
+        ++p->fullHandshakes;
+}
+
+// returns -1 on error, 0 if ticket key is unknown (i.e. full handshake),
+// 1 on success and 2 if ticket should be renewed
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int TlsSessionResumption::Private::TicketKeyCallback(
+    SSL* ssl,
+    unsigned char* keyName,
+    unsigned char* iv,
+    EVP_CIPHER_CTX* cipherCtx,
+    EVP_MAC_CTX* hmacCtx,
+    int encrypt)
+#else
+int TlsSessionResumption::Private::TicketKeyCallback(
+    SSL* ssl,
+    unsigned char* keyName,
+    unsigned char* iv,
+    EVP_CIPHER_CTX* cipherCtx,
+    HMAC_CTX* hmacCtx,
+    int encrypt)
+#endif
+{
+    Private* p = FromSsl(ssl);
+    if(!p)
+        return -1;
+
+    p->rotateTicketKeys();
+
+    const TicketKey* key;
+    if(encrypt) {
+        key = &p->currentTicketKey;
+
+        if(RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+            return -1;
+
+        memcpy(keyName, key->name, sizeof(key->name));
+
+        if(EVP_EncryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key->aesKey, iv) != 1)
+            return -1;
+    } else {
+        key = p->findTicketKey(keyName);
+        if(!key)
+            return 0;
+
+        if(EVP_DecryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key->aesKey, iv) != 1)
+            return -1;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    char digest[] = "SHA256";
+    const OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(
+            OSSL_MAC_PARAM_KEY,
+            const_cast<unsigned char*>(key->hmacKey),
+            sizeof(key->hmacKey)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+    };
+    if(EVP_MAC_CTX_set_params(hmacCtx, params) != 1)
+        return -1;
+#else
+    if(HMAC_Init_ex(hmacCtx, key->hmacKey, sizeof(key->hmacKey), EVP_sha256(), nullptr) != 1)
+        return -1;
+#endif
+
+    return (!encrypt && key != &p->currentTicketKey) ? 2 : 1;
+}
+
+bool TlsSessionResumption::Private::generateTicketKey(TicketKey* key)
+{
+    return RAND_bytes(reinterpret_cast<unsigned char*>(key), sizeof(*key)) == 1;
+}
+
+void TlsSessionResumption::Private::rotateTicketKeys()
+{
+    if(!config.ticketKeyRotationInterval)
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    if(now - ticketKeyCreated < std::chrono::seconds(config.ticketKeyRotationInterval))
+        return;
+
+    TicketKey newTicketKey;
+    if(!generateTicketKey(&newTicketKey))
+        return;
+
+    // tickets older than two intervals are not accepted anymore
+    hasPreviousTicketKey =
+        now - ticketKeyCreated < std::chrono::seconds(2 * config.ticketKeyRotationInterval);
+    previousTicketKey = currentTicketKey;
+    currentTicketKey = newTicketKey;
+    ticketKeyCreated = now;
+}
+
+const TlsSessionResumption::Private::TicketKey*
+TlsSessionResumption::Private::findTicketKey(const unsigned char* name) const
+{
+    if(0 == memcmp(name, currentTicketKey.name, sizeof(currentTicketKey.name)))
+        return &currentTicketKey;
+
+    if(hasPreviousTicketKey &&
+        0 == memcmp(name, previousTicketKey.name, sizeof(previousTicketKey.name)))
+    {
+        return &previousTicketKey;
+    }
+
+    return nullptr;
+}
+
+#endif
+
+TlsSessionResumption::TlsSessionResumption(const TlsSessionResumptionConfig& config) noexcept :
+    _p(std::make_unique<Private>(config))
+{
+}
+
+TlsSessionResumption::~TlsSessionResumption()
+{
+}
+
+bool TlsSessionResumption::apply(void* sslCtx) noexcept
+{
+#if TLS_SESSION_RESUMPTION_SUPPORTED
+    SSL_CTX* ctx = static_cast<SSL_CTX*>(sslCtx);
+    if(!ctx)
+        return false;
+
+    if(SSL_CTX_set_ex_data(ctx, Private::ExDataIndex(), _p.get()) != 1)
+        return false;
+
+    SSL_CTX_set_info_callback(ctx, Private::InfoCallback);
+
+    if(_p->config.sessionCacheSize) {
+        static const unsigned char sessionIdContext[] = "webrtsp";
+
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, _p->config.sessionCacheSize);
+        SSL_CTX_set_timeout(ctx, _p->config.sessionTimeout);
+        SSL_CTX_set_session_id_context(ctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+    } else
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+    if(!_p->config.sessionTickets) {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        return true;
+    }
+
+    if(!_p->hasTicketKey) {
+        if(!_p->generateTicketKey(&_p->currentTicketKey))
+            return false;
+
+        _p->hasTicketKey = true;
+        _p->ticketKeyCreated = std::chrono::steady_clock::now();
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if(SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, Private::TicketKeyCallback) != 1)
+        return false;
+#else
+    if(SSL_CTX_set_tlsext_ticket_key_cb(ctx, Private::TicketKeyCallback) != 1)
+        return false;
+#endif
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+unsigned long long TlsSessionResumption::fullHandshakes() const noexcept
+{
+    return _p->fullHandshakes;
+}
+
+unsigned long long TlsSessionResumption::resumedHandshakes() const noexcept
+{
+    return _p->resumedHandshakes;
+}
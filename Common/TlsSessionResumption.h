@@ -0,0 +1,36 @@
+#pragma once
+
+#include <memory>
+
+
+struct TlsSessionResumptionConfig
+{
+    // server side session cache, 0 - disabled
+    unsigned sessionCacheSize = 20 * 1024;
+    unsigned sessionTimeout = 300; // seconds
+
+    // RFC 5077 session tickets
+    bool sessionTickets = true;
+    // tickets issued with previous key are still accepted (and renewed)
+    // during one more interval, 0 - key is never rotated
+    unsigned ticketKeyRotationInterval = 3600; // seconds
+};
+
+// Lets reconnecting clients skip full TLS handshake.
+// Should be applied to SSL_CTX of vhost on
+// LWS_CALLBACK_OPENSSL_LOAD_EXTRA_SERVER_VERIFY_CERTS and outlive it.
+class TlsSessionResumption
+{
+public:
+    explicit TlsSessionResumption(const TlsSessionResumptionConfig&) noexcept;
+    ~TlsSessionResumption();
+
+    bool apply(void* sslCtx) noexcept;
+
+    unsigned long long fullHandshakes() const noexcept;
+    unsigned long long resumedHandshakes() const noexcept;
+
+private:
+    struct Private;
+    std::unique_ptr<Private> _p;
+};
@@ -2,11 +2,16 @@
 
 #include <string>
 
+#include "Common/EventLoop.h"
+#include "Common/TlsSessionResumption.h"
+
 
 namespace http {
 
 struct Config
 {
+    EventLoop eventLoop = EventLoop::GLib;
+
     std::string serverName;
     std::string certificate;
     std::string key;
@@ -16,6 +21,8 @@ struct Config
     bool secureBindToLoopbackOnly = false;
     unsigned short securePort = 5443;
 
+    TlsSessionResumptionConfig tlsSessionResumption;
+
     std::string wwwRoot = "./www";
 };
 
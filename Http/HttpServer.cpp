@@ -5,6 +5,8 @@
 
 #include <CxxPtr/libwebsocketsPtr.h>
 
+#include "Common/TlsSessionResumption.h"
+
 #include "Log.h"
 
 
@@ -23,13 +25,19 @@ struct Server::Private
 
     bool init(lws_context* context);
 
+    int vhostCallback(lws*, lws_callback_reasons, void* user, void* in, size_t len);
     int httpCallback(lws*, lws_callback_reasons, void* user, void* in, size_t len);
 
     Server *const owner;
     Config config;
     GMainLoop* loop;
 
+    // should outlive SSL_CTX of secure vhost
+    TlsSessionResumption tlsSessionResumption;
+
     LwsContextPtr contextPtr;
+    lws_context* context = nullptr;
+    NativeLoop nativeLoop;
 
     std::vector<uint8_t> configJsBuffer;
 };
@@ -41,11 +49,29 @@ Server::Private::Private(
     GMainLoop* loop) :
     owner(owner),
     config(config),
-    loop(loop)
+    loop(loop),
+    tlsSessionResumption(config.tlsSessionResumption)
 {
     configJsBuffer.assign(configJs.begin(), configJs.end());
 }
 
+int Server::Private::vhostCallback(
+    lws* wsi,
+    lws_callback_reasons reason,
+    void* user,
+    void* in,
+    size_t len)
+{
+    switch(reason) {
+        case LWS_CALLBACK_OPENSSL_LOAD_EXTRA_SERVER_VERIFY_CERTS:
+            if(!tlsSessionResumption.apply(user))
+                Log()->warn("Failed to enable TLS session resumption");
+            return 0;
+        default:
+            return lws_callback_http_dummy(wsi, reason, user, in, len);
+    }
+}
+
 int Server::Private::httpCallback(
     lws* wsi,
     lws_callback_reasons reason,
@@ -101,6 +127,13 @@ bool Server::Private::init(lws_context* context)
         "application/javascript"
     };
 
+    auto vhostCallback =
+        [] (lws* wsi, lws_callback_reasons reason, void* user, void* in, size_t len) -> int {
+            lws_vhost* vhost = lws_get_vhost(wsi);
+            Private* p = static_cast<Private*>(lws_get_vhost_user(vhost));
+
+            return p->vhostCallback(wsi, reason, user, in, len);
+        };
     auto configHttpCallback =
         [] (lws* wsi, lws_callback_reasons reason, void* user, void* in, size_t len) -> int {
             lws_vhost* vhost = lws_get_vhost(wsi);
@@ -110,7 +143,7 @@ bool Server::Private::init(lws_context* context)
         };
 
     static const struct lws_protocols protocols[] = {
-        { "default", lws_callback_http_dummy, 0, 0 },
+        { "default", vhostCallback, 0, 0 },
         { "config_http", configHttpCallback, 0, 0 },
         nullptr// { nullptr, nullptr, 0, 0 }
     };
@@ -159,8 +192,10 @@ bool Server::Private::init(lws_context* context)
         info.gid = -1;
         info.uid = -1;
         info.options = LWS_SERVER_OPTION_EXPLICIT_VHOSTS;
-        info.options |= LWS_SERVER_OPTION_GLIB;
-        info.foreign_loops = reinterpret_cast<void**>(&loop);
+        if(config.eventLoop == EventLoop::GLib) {
+            info.options |= LWS_SERVER_OPTION_GLIB;
+            info.foreign_loops = reinterpret_cast<void**>(&loop);
+        }
 
         contextPtr.reset(lws_create_context(&info));
         context = contextPtr.get();
@@ -168,6 +203,8 @@ bool Server::Private::init(lws_context* context)
     if(!context)
         return false;
 
+    this->context = context;
+
     if(config.port != 0) {
         Log()->info("Starting HTTP server on port {}", config.port);
 
@@ -191,6 +228,7 @@ bool Server::Private::init(lws_context* context)
 
         lws_context_creation_info secureVhostInfo {};
         secureVhostInfo.port = config.securePort;
+        secureVhostInfo.protocols = protocols;
         secureVhostInfo.mounts = &mount;
         secureVhostInfo.error_document_404 = "/404.html";
         secureVhostInfo.ssl_cert_filepath = config.certificate.c_str();
@@ -227,4 +265,25 @@ bool Server::init(lws_context* context /*= nullptr*/) noexcept
     return _p->init(context);
 }
 
+void Server::run() noexcept
+{
+    if(_p->context)
+        _p->nativeLoop.run(_p->context);
+}
+
+void Server::stop() noexcept
+{
+    if(_p->context)
+        _p->nativeLoop.stop(_p->context);
+}
+
+Server::Stats Server::stats() const noexcept
+{
+    Stats stats {};
+    stats.fullTlsHandshakes = _p->tlsSessionResumption.fullHandshakes();
+    stats.resumedTlsHandshakes = _p->tlsSessionResumption.resumedHandshakes();
+
+    return stats;
+}
+
 }
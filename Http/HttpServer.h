@@ -17,10 +17,23 @@ namespace http {
 class Server
 {
 public:
+    struct Stats
+    {
+        unsigned long long fullTlsHandshakes;
+        unsigned long long resumedTlsHandshakes;
+    };
+
+    // GMainLoop could be nullptr with EventLoop::Native
     Server(const Config&, const std::string& configJs, GMainLoop*) noexcept;
     bool init(lws_context* = nullptr) noexcept;
     ~Server();
 
+    // EventLoop::Native only
+    void run() noexcept;
+    void stop() noexcept;
+
+    Stats stats() const noexcept;
+
 private:
     struct Private;
     std::unique_ptr<Private> _p;
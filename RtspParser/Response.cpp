@@ -1,5 +1,7 @@
 #include "Response.h"
 
+#include <climits>
+
 
 namespace rtsp {
 
@@ -26,4 +28,25 @@ std::string ResponseContentType(const Response& response)
     return it->second;
 }
 
+unsigned ResponseRetryAfter(const Response& response)
+{
+    auto it = response.headerFields.find("retry-after");
+    if(response.headerFields.end() == it)
+        return 0;
+
+    unsigned retryAfter = 0;
+    for(const std::string::value_type& c: it->second) {
+        if(c < '0' || c > '9')
+            return 0;
+
+        const unsigned digit = c - '0';
+        if(retryAfter > (UINT_MAX - digit) / 10)
+            return 0; // overflow
+
+        retryAfter = retryAfter * 10 + digit;
+    }
+
+    return retryAfter;
+}
+
 }
@@ -23,5 +23,7 @@ struct Response {
 SessionId ResponseSession(const Response&);
 void SetResponseSession(Response*, const SessionId&);
 std::string ResponseContentType(const Response& request);
+// delay in seconds, 0 if missing or not in delta-seconds form
+unsigned ResponseRetryAfter(const Response&);
 
 }
@@ -1,6 +1,7 @@
 #include "RtspParser.h"
 
 #include <cstddef>
+#include <climits>
 #include <cassert>
 #include <cstring>
 #include <algorithm>
@@ -624,4 +625,52 @@ std::set<rtsp::Method> ParseOptions(const Response& response)
     return returnOptions;
 }
 
+bool ParseIceCandidate(
+    const std::string& body,
+    size_t* pos,
+    unsigned* mlineIndex,
+    Token* candidate) noexcept
+{
+    const char* buf = body.data();
+    const size_t size = body.size();
+    size_t tmpPos = *pos;
+
+    unsigned tmpIndex = 0;
+    const size_t indexPos = tmpPos;
+    for(; tmpPos < size && IsDigit(buf[tmpPos]); ++tmpPos) {
+        const unsigned digit = ParseDigit(buf[tmpPos]);
+
+        if(tmpIndex > (UINT_MAX - digit) / 10) {
+            // overflow
+            return false;
+        }
+
+        tmpIndex = tmpIndex * 10 + digit;
+    }
+
+    if(tmpPos == indexPos)
+        return false;
+
+    if(!Skip(buf, &tmpPos, size, '/'))
+        return false;
+
+    const size_t candidatePos = tmpPos;
+    for(; tmpPos < size && !IsEOL(buf, tmpPos, size); ++tmpPos);
+
+    if(tmpPos == candidatePos)
+        return false;
+
+    const size_t candidateEndPos = tmpPos;
+
+    if(!SkipEOL(buf, &tmpPos, size))
+        return false;
+
+    *mlineIndex = tmpIndex;
+    candidate->token = buf + candidatePos;
+    candidate->size = candidateEndPos - candidatePos;
+    *pos = tmpPos;
+
+    return true;
+}
+
 }
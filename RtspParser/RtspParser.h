@@ -6,6 +6,7 @@
 #include "Common.h"
 #include "Request.h"
 #include "Response.h"
+#include "Token.h"
 
 
 namespace rtsp {
@@ -29,4 +30,13 @@ bool ParseParametersNames(
 
 std::set<rtsp::Method> ParseOptions(const Response&);
 
+// parses one "<mlineIndex>/<candidate>\r\n" line of application/x-ice-candidate body
+// starting from *pos and moves *pos to the next line;
+// candidate points inside body
+bool ParseIceCandidate(
+    const std::string& body,
+    size_t* pos,
+    unsigned* mlineIndex,
+    Token* candidate) noexcept;
+
 }
@@ -1,5 +1,7 @@
 #include "RtspSerialize.h"
 
+#include <limits>
+
 
 namespace rtsp {
 
@@ -26,8 +28,10 @@ void SerializeStatusCode(unsigned statusCode, std::string* out)
 
 void Serialize(const Request& request, std::string* out) noexcept
 {
+    const std::string::size_type initialSize = out->size();
+
     try {
-        *out = MethodName(request.method);
+        *out += MethodName(request.method);
         *out += " ";
         *out += request.uri;
         *out += " ";
@@ -50,7 +54,7 @@ void Serialize(const Request& request, std::string* out) noexcept
             *out += request.body;
         }
     } catch(...) {
-        out->clear();
+        out->resize(initialSize);
     }
 }
 
@@ -63,8 +67,10 @@ std::string Serialize(const Request& request) noexcept
 
 void Serialize(const Response& response, std::string* out) noexcept
 {
+    const std::string::size_type initialSize = out->size();
+
     try {
-        *out = ProtocolName(response.protocol);
+        *out += ProtocolName(response.protocol);
         *out += " ";
         SerializeStatusCode(response.statusCode, out);
         *out += " ";
@@ -87,7 +93,7 @@ void Serialize(const Response& response, std::string* out) noexcept
             *out += response.body;
         }
     } catch(...) {
-        out->clear();
+        out->resize(initialSize);
     }
 }
 
@@ -98,4 +104,27 @@ std::string Serialize(const Response& response) noexcept
     return out;
 }
 
+void SerializeIceCandidate(
+    unsigned mlineIndex,
+    const std::string& candidate,
+    std::string* out) noexcept
+{
+    char index[std::numeric_limits<unsigned>::digits10 + 1];
+    char* indexBegin = index + sizeof(index);
+    do {
+        *(--indexBegin) = '0' + mlineIndex % 10;
+        mlineIndex /= 10;
+    } while(mlineIndex);
+
+    const size_t savedSize = out->size();
+    try {
+        out->append(indexBegin, index + sizeof(index));
+        *out += '/';
+        *out += candidate;
+        *out += "\r\n";
+    } catch(...) {
+        out->resize(savedSize);
+    }
+}
+
 }
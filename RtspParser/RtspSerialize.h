@@ -6,10 +6,18 @@
 
 namespace rtsp {
 
+// appends serialized message to out,
+// out is left intact on failure
 void Serialize(const Request&, std::string* out) noexcept;
 std::string Serialize(const Request&) noexcept;
 
 void Serialize(const Response&, std::string* out) noexcept;
 std::string Serialize(const Response&) noexcept;
 
+// appends "<mlineIndex>/<candidate>\r\n" line of application/x-ice-candidate body
+void SerializeIceCandidate(
+    unsigned mlineIndex,
+    const std::string& candidate,
+    std::string* out) noexcept;
+
 }
@@ -102,6 +102,11 @@ bool ClientSession::handleResponse(
     const Request& request,
     std::unique_ptr<Response>& responsePtr) noexcept
 {
+    // only the last reply is relevant, so stale one doesn't delay reconnect
+    _retryAfter =
+        SERVICE_UNAVAILABLE == responsePtr->statusCode ?
+            ResponseRetryAfter(*responsePtr) : 0;
+
     switch(request.method) {
         case Method::OPTIONS:
             return onOptionsResponse(request, *responsePtr);
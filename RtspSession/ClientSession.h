@@ -17,6 +17,9 @@ struct ClientSession : public Session
 
     bool isSupported(Method);
 
+    unsigned retryAfter() const noexcept override
+        { return _retryAfter; }
+
 protected:
     using Session::Session;
 
@@ -55,6 +58,7 @@ protected:
 
 private:
     std::set<Method> _supportedMethods;
+    unsigned _retryAfter = 0;
 };
 
 }
@@ -0,0 +1,54 @@
+#include "MessagePriority.h"
+
+
+namespace rtsp {
+
+namespace {
+
+SessionId OutgoingSession(const std::map<std::string, std::string>& headerFields)
+{
+    auto it = headerFields.find("Session");
+    if(headerFields.end() == it)
+        it = headerFields.find("session");
+
+    return headerFields.end() == it ? SessionId() : it->second;
+}
+
+}
+
+MessagePriority RequestPriority(const Request& request) noexcept
+{
+    switch(request.method) {
+    case Method::OPTIONS:
+    case Method::PLAY:
+    case Method::RECORD:
+    case Method::TEARDOWN:
+        return MessagePriority::High;
+    case Method::SETUP:
+        if(RequestContentType(request) == "application/x-ice-candidate")
+            return MessagePriority::High;
+        else
+            return MessagePriority::Normal;
+    default:
+        return MessagePriority::Normal;
+    }
+}
+
+MessagePriority ResponsePriority(const Response& response) noexcept
+{
+    return response.body.empty() ?
+        MessagePriority::High :
+        MessagePriority::Normal;
+}
+
+SessionId OutgoingRequestSession(const Request& request) noexcept
+{
+    return OutgoingSession(request.headerFields);
+}
+
+SessionId OutgoingResponseSession(const Response& response) noexcept
+{
+    return OutgoingSession(response.headerFields);
+}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+
+#include "RtspParser/Request.h"
+#include "RtspParser/Response.h"
+
+
+namespace rtsp {
+
+enum class MessagePriority {
+    High,
+    Normal,
+};
+
+// Connection establishment and control messages
+// (ICE candidates, PLAY, RECORD, TEARDOWN and bodiless replies)
+// are High, anything carrying SDP or parameters is Normal.
+MessagePriority RequestPriority(const Request&) noexcept;
+MessagePriority ResponsePriority(const Response&) noexcept;
+
+// Session header of outgoing message (it's not normalized to lower case),
+// empty if there is no one
+SessionId OutgoingRequestSession(const Request&) noexcept;
+SessionId OutgoingResponseSession(const Response&) noexcept;
+
+// High priority message can't overtake queued message of the same session
+// (f.e. ICE candidate can't go ahead of DESCRIBE reply with session SDP).
+// Queue elements should have SessionId session member.
+template<typename Queue>
+bool CanPrioritize(
+    MessagePriority priority,
+    const SessionId& session,
+    const Queue& queued) noexcept
+{
+    return
+        priority == MessagePriority::High &&
+        (session.empty() ||
+            std::none_of(
+                queued.begin(),
+                queued.end(),
+                [&session] (const typename Queue::value_type& message) {
+                    return message.session == session;
+                }));
+}
+
+}
@@ -18,6 +18,13 @@ struct Session
 
     virtual bool onConnected() noexcept { return true; }
 
+    // media sessions (i.e. WebRTC peers) currently alive
+    virtual unsigned mediaSessionsCount() const noexcept { return 0; }
+
+    // seconds peer asked to wait before the next attempt
+    // with the last reply (f.e. 503 Service Unavailable), 0 - not requested
+    virtual unsigned retryAfter() const noexcept { return 0; }
+
     virtual bool handleRequest(std::unique_ptr<Request>&) noexcept;
 
     bool handleResponse(std::unique_ptr<Response>& responsePtr) noexcept;
@@ -6,6 +6,7 @@ namespace rtsp {
 enum StatusCode {
     OK = 200,
     BAD_GATEWAY = 502,
+    SERVICE_UNAVAILABLE = 503,
 };
 
 }
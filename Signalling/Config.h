@@ -1,12 +1,28 @@
 #pragma once
 
 #include <string>
+#include <cstddef>
+
+#include "Common/EventLoop.h"
+#include "Common/TlsSessionResumption.h"
 
 
 namespace signalling {
 
+enum class OverflowPolicy {
+    Disconnect,
+    // drop ICE candidates superseded by queued TEARDOWN or new SDP,
+    // disconnect if it's not enough
+    DropIceCandidates,
+    // stop reading from connection until queue is drained,
+    // disconnect if queue still grows up to twice the limits
+    PauseReceiving,
+};
+
 struct Config
 {
+    EventLoop eventLoop = EventLoop::GLib;
+
     std::string serverName;
     std::string certificate;
     std::string key;
@@ -15,6 +31,56 @@ struct Config
     unsigned short port = 5554;
     bool secureBindToLoopbackOnly = false;
     unsigned short securePort = 5555;
+
+    TlsSessionResumptionConfig tlsSessionResumption;
+
+    // if not empty, used instead of corresponding port
+    // (f.e. to be proxied from local nginx)
+    std::string unixSocket;
+    std::string secureUnixSocket;
+
+    // max messages written per LWS_CALLBACK_SERVER_WRITEABLE
+    unsigned maxMessagesPerWriteable = 16;
+
+    // per connection outbound queue limits, 0 - unlimited
+    size_t maxOutboundBytes = 0;
+    unsigned maxOutboundMessages = 0;
+    OverflowPolicy overflowPolicy = OverflowPolicy::Disconnect;
+
+    // max unused message buffers kept for reuse
+    unsigned maxPooledBuffers = 1024;
+
+    bool permessageDeflate = false;
+
+    // last messages kept per connection to be logged on failure, 0 - disabled
+    unsigned flightRecorderSize = 0;
+    unsigned flightRecorderPayloadSize = 256;
+
+    // 0 - unlimited
+    unsigned maxConnectionsPerIp = 0;
+
+    // per connection token buckets (messages per second), 0 - unlimited
+    double messagesRate = 0;
+    unsigned messagesBurst = 200;
+    // DESCRIBE and ANNOUNCE, i.e. requests creating WebRTC peer
+    double peerCreationsRate = 0;
+    unsigned peerCreationsBurst = 10;
+
+    // per connection processing budget for single loop iteration,
+    // the rest of incoming messages is deferred to the next iteration.
+    // 0 - unlimited
+    unsigned maxMessagesPerIteration = 0;
+    unsigned maxHandlingTimePerIteration = 0; // microseconds
+
+    // interval of timestamped pings used for RTT measurement, 0 - disabled
+    unsigned rttPingInterval = 0; // seconds
+
+    // DESCRIBE and ANNOUNCE are answered with 503 Service Unavailable
+    // while any of the limits is exceeded, 0 - unlimited
+    unsigned maxLoopLag = 0; // microseconds
+    unsigned maxMediaSessions = 0;
+    // sent to client with 503 reply
+    unsigned retryAfter = 5; // seconds
 };
 
 }
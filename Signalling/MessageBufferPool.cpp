@@ -0,0 +1,83 @@
+#include "MessageBufferPool.h"
+
+
+namespace signalling {
+
+namespace {
+
+enum {
+    // enough for usual SDP, buffers grown by larger messages
+    // are freed so they don't hold memory while pooled
+    MAX_POOLED_PAYLOAD_CAPACITY = 16 * 1024,
+};
+
+}
+
+PooledBuffer::PooledBuffer(MessageBufferPool* pool) :
+    _pool(pool)
+{
+    reset();
+}
+
+void PooledBuffer::reset()
+{
+    // capacity is kept for the next message
+    _data.assign(LWS_PRE, '\0');
+}
+
+bool PooledBuffer::writeAsText(lws* wsi)
+{
+    if(empty())
+        return true;
+
+    unsigned char* payload = reinterpret_cast<unsigned char*>(&_data[LWS_PRE]);
+
+    return lws_write(wsi, payload, size(), LWS_WRITE_TEXT) >= 0;
+}
+
+void PooledBufferPtr::release() noexcept
+{
+    if(_buffer && 0 == --_buffer->_refs)
+        _buffer->_pool->release(_buffer);
+
+    _buffer = nullptr;
+}
+
+MessageBufferPool::MessageBufferPool(unsigned maxPooled) noexcept :
+    _maxPooled(maxPooled)
+{
+}
+
+MessageBufferPool::~MessageBufferPool()
+{
+}
+
+MessageBufferPool::BufferPtr MessageBufferPool::acquire()
+{
+    if(_freeBuffers.empty())
+        return BufferPtr(new PooledBuffer(this));
+
+    std::unique_ptr<PooledBuffer> bufferPtr = std::move(_freeBuffers.back());
+    _freeBuffers.pop_back();
+
+    return BufferPtr(bufferPtr.release());
+}
+
+void MessageBufferPool::release(PooledBuffer* buffer) noexcept
+{
+    std::unique_ptr<PooledBuffer> bufferPtr(buffer);
+
+    if(_freeBuffers.size() >= _maxPooled ||
+        bufferPtr->_data.capacity() > LWS_PRE + MAX_POOLED_PAYLOAD_CAPACITY)
+    {
+        return;
+    }
+
+    try {
+        bufferPtr->reset();
+        _freeBuffers.emplace_back(std::move(bufferPtr));
+    } catch(...) {
+    }
+}
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+
+#include <libwebsockets.h>
+
+
+namespace signalling {
+
+class MessageBufferPool;
+
+// Outgoing message with LWS_PRE headroom in front of payload,
+// so message is serialized and written in place.
+// Reference counted intrusively since the same message
+// could be queued to many connections.
+class PooledBuffer
+{
+public:
+    // serialized message should be appended to it
+    std::string* payloadBuffer()
+        { return &_data; }
+
+    const char* data() const
+        { return _data.data() + LWS_PRE; }
+    size_t size() const
+        { return _data.size() - LWS_PRE; }
+    bool empty() const
+        { return size() == 0; }
+
+    // only LWS_PRE headroom is modified,
+    // so it's safe to write the same buffer to many connections
+    bool writeAsText(lws*);
+
+private:
+    friend class MessageBufferPool;
+    friend class PooledBufferPtr;
+
+    explicit PooledBuffer(MessageBufferPool* pool);
+
+    void reset();
+
+private:
+    MessageBufferPool *const _pool;
+    unsigned _refs = 0;
+    std::string _data;
+};
+
+class PooledBufferPtr
+{
+public:
+    PooledBufferPtr() noexcept {}
+    PooledBufferPtr(const PooledBufferPtr& other) noexcept :
+        _buffer(other._buffer) { addRef(); }
+    PooledBufferPtr(PooledBufferPtr&& other) noexcept :
+        _buffer(other._buffer) { other._buffer = nullptr; }
+    ~PooledBufferPtr()
+        { release(); }
+
+    PooledBufferPtr& operator = (PooledBufferPtr other) noexcept
+        { std::swap(_buffer, other._buffer); return *this; }
+
+    PooledBuffer* get() const noexcept
+        { return _buffer; }
+    PooledBuffer* operator -> () const noexcept
+        { return _buffer; }
+    PooledBuffer& operator * () const noexcept
+        { return *_buffer; }
+    explicit operator bool () const noexcept
+        { return _buffer != nullptr; }
+
+private:
+    friend class MessageBufferPool;
+
+    explicit PooledBufferPtr(PooledBuffer* buffer) noexcept :
+        _buffer(buffer) { addRef(); }
+
+    void addRef() noexcept
+        { if(_buffer) ++_buffer->_refs; }
+    void release() noexcept;
+
+private:
+    PooledBuffer* _buffer = nullptr;
+};
+
+// Recycles outgoing message buffers (and their allocated storage)
+// between outgoing messages of all connections.
+// Buffers grown by large messages are not pooled.
+// Should outlive every buffer acquired from it.
+class MessageBufferPool
+{
+public:
+    typedef PooledBufferPtr BufferPtr;
+
+    explicit MessageBufferPool(unsigned maxPooled) noexcept;
+    ~MessageBufferPool();
+
+    // empty buffer with reserved headroom
+    BufferPtr acquire();
+
+    unsigned pooled() const noexcept
+        { return static_cast<unsigned>(_freeBuffers.size()); }
+
+private:
+    friend class PooledBufferPtr;
+
+    void release(PooledBuffer*) noexcept;
+
+private:
+    const unsigned _maxPooled;
+    std::vector<std::unique_ptr<PooledBuffer>> _freeBuffers;
+};
+
+}
@@ -0,0 +1,117 @@
+#include "OfferStructureStats.h"
+
+#include <cstring>
+#include <unordered_map>
+
+#include "Log.h"
+
+
+namespace {
+
+const auto Log = ServerSessionLog;
+
+// attributes unique for every peer even with the same media configuration
+const char* const PeerSpecificPrefixes[] = {
+    "o=",
+    "a=ice-ufrag:",
+    "a=ice-pwd:",
+    "a=fingerprint:",
+    "a=candidate:",
+    "a=end-of-candidates",
+    "a=ssrc:",
+    "a=ssrc-group:",
+    "a=msid:",
+};
+
+bool IsPeerSpecific(const char* line, size_t size)
+{
+    for(const char* prefix: PeerSpecificPrefixes) {
+        const size_t prefixSize = strlen(prefix);
+        if(size >= prefixSize && 0 == memcmp(line, prefix, prefixSize))
+            return true;
+    }
+
+    return false;
+}
+
+void StripOffer(const std::string& sdp, std::string* out)
+{
+    out->clear();
+    out->reserve(sdp.size());
+
+    std::string::size_type pos = 0;
+    while(pos < sdp.size()) {
+        std::string::size_type lineEndPos = sdp.find('\n', pos);
+        if(lineEndPos == std::string::npos)
+            lineEndPos = sdp.size();
+
+        std::string::size_type lineSize = lineEndPos - pos;
+        if(lineSize && sdp[pos + lineSize - 1] == '\r')
+            --lineSize;
+
+        if(lineSize && !IsPeerSpecific(sdp.data() + pos, lineSize)) {
+            out->append(sdp, pos, lineSize);
+            *out += "\r\n";
+        }
+
+        pos = lineEndPos + 1;
+    }
+}
+
+}
+
+struct OfferStructureStats::Private
+{
+    // URI -> stripped offer structure, empty if nothing seen yet
+    std::unordered_map<std::string, std::string> offers;
+
+    Stats stats {};
+};
+
+OfferStructureStats::OfferStructureStats() noexcept :
+    _p(std::make_unique<Private>())
+{
+}
+
+OfferStructureStats::~OfferStructureStats()
+{
+}
+
+void OfferStructureStats::addUri(const std::string& uri) noexcept
+{
+    if(_p->offers.emplace(uri, std::string()).second)
+        ++_p->stats.uris;
+}
+
+void OfferStructureStats::update(const std::string& uri, const std::string& sdp) noexcept
+{
+    auto it = _p->offers.find(uri);
+    if(it == _p->offers.end())
+        return;
+
+    std::string& previousStructure = it->second;
+
+    std::string structure;
+    StripOffer(sdp, &structure);
+
+    if(previousStructure.empty()) {
+        ++_p->stats.firsts;
+        previousStructure.swap(structure);
+        return;
+    }
+
+    if(previousStructure == structure) {
+        ++_p->stats.matches;
+        return;
+    }
+
+    Log()->info("Offer structure changed. Uri: {}", uri);
+
+    ++_p->stats.changes;
+    previousStructure.swap(structure);
+}
+
+OfferStructureStats::Stats OfferStructureStats::stats() const noexcept
+{
+    return _p->stats;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+
+// Per URI statistics of SDP offer structure stability, i.e. offers with
+// per peer attributes (origin, ICE credentials, DTLS fingerprint,
+// candidates, SSRCs) stripped are compared with the previous one.
+// Only URIs explicitly added are tracked.
+class OfferStructureStats
+{
+public:
+    struct Stats
+    {
+        unsigned uris; // added URIs
+        unsigned long long matches; // offer matched previous structure
+        unsigned long long firsts; // no previous structure yet
+        unsigned long long changes; // offer differed from previous structure
+    };
+
+    OfferStructureStats() noexcept;
+    ~OfferStructureStats();
+
+    void addUri(const std::string& uri) noexcept;
+
+    // accounts offer against previous structure if URI was added
+    void update(const std::string& uri, const std::string& sdp) noexcept;
+
+    Stats stats() const noexcept;
+
+private:
+    struct Private;
+    std::unique_ptr<Private> _p;
+};
@@ -0,0 +1,299 @@
+#include "PeerAdmission.h"
+
+#include <list>
+#include <algorithm>
+#include <unordered_map>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+
+
+namespace {
+
+const auto Log = ServerSessionLog;
+
+}
+
+struct PeerAdmission::Private
+{
+    class AdmissionTicket;
+    class AdmissionWaiter;
+
+    struct Entry
+    {
+        std::string uri;
+        Admitted admitted;
+        AdmissionWaiter* waiter;
+        GSourcePtr timeoutSource;
+    };
+    typedef std::list<Entry> Queue;
+
+    Private(const Config&);
+    ~Private();
+
+    bool hasCapacity(const std::string& uri) const;
+    TicketPtr acquire(const std::string& uri);
+    void release(const std::string& uri);
+
+    void cancel(Queue::iterator);
+    void timeout(Queue::iterator);
+
+    void scheduleDispatch();
+    void dispatch();
+
+    const Config config;
+    GMainContext* context;
+    std::weak_ptr<Private> weakThis;
+
+    std::unordered_map<std::string, unsigned> uriPeers;
+    Queue queue;
+
+    GSourcePtr dispatchSource;
+
+    Stats stats {};
+};
+
+class PeerAdmission::Private::AdmissionTicket : public PeerAdmission::Ticket
+{
+public:
+    AdmissionTicket(const std::weak_ptr<Private>& owner, const std::string& uri) :
+        _owner(owner), _uri(uri) {}
+    ~AdmissionTicket()
+    {
+        // admission could be destroyed before peer
+        if(std::shared_ptr<Private> owner = _owner.lock())
+            owner->release(_uri);
+    }
+
+private:
+    const std::weak_ptr<Private> _owner;
+    const std::string _uri;
+};
+
+class PeerAdmission::Private::AdmissionWaiter : public PeerAdmission::Waiter
+{
+public:
+    AdmissionWaiter(const std::weak_ptr<Private>& owner, Private::Queue::iterator entry) :
+        _owner(owner), _queued(true), _entry(entry) {}
+    ~AdmissionWaiter()
+    {
+        if(!_queued)
+            return;
+
+        if(std::shared_ptr<Private> owner = _owner.lock())
+            owner->cancel(_entry);
+    }
+
+private:
+    friend struct PeerAdmission::Private;
+
+    const std::weak_ptr<Private> _owner;
+    bool _queued;
+    const Private::Queue::iterator _entry;
+};
+
+PeerAdmission::Private::Private(const Config& config) :
+    config(config), context(g_main_context_get_thread_default())
+{
+}
+
+PeerAdmission::Private::~Private()
+{
+    if(dispatchSource)
+        g_source_destroy(dispatchSource.get());
+
+    for(Entry& entry: queue) {
+        if(entry.timeoutSource)
+            g_source_destroy(entry.timeoutSource.get());
+
+        entry.waiter->_queued = false;
+    }
+}
+
+bool PeerAdmission::Private::hasCapacity(const std::string& uri) const
+{
+    if(config.maxPeers && stats.activePeers >= config.maxPeers)
+        return false;
+
+    if(config.maxPeersPerUri) {
+        auto it = uriPeers.find(uri);
+        if(it != uriPeers.end() && it->second >= config.maxPeersPerUri)
+            return false;
+    }
+
+    return true;
+}
+
+PeerAdmission::TicketPtr PeerAdmission::Private::acquire(const std::string& uri)
+{
+    ++stats.activePeers;
+    ++stats.admitted;
+    ++uriPeers[uri];
+
+    return std::make_unique<AdmissionTicket>(weakThis, uri);
+}
+
+void PeerAdmission::Private::release(const std::string& uri)
+{
+    --stats.activePeers;
+
+    auto it = uriPeers.find(uri);
+    if(it != uriPeers.end() && 0 == --it->second)
+        uriPeers.erase(it);
+
+    if(!queue.empty())
+        scheduleDispatch();
+}
+
+void PeerAdmission::Private::cancel(Queue::iterator it)
+{
+    if(it->timeoutSource)
+        g_source_destroy(it->timeoutSource.get());
+
+    queue.erase(it);
+    --stats.queued;
+}
+
+void PeerAdmission::Private::timeout(Queue::iterator it)
+{
+    Log()->debug("Peer admission wait timed out. Uri: {}", it->uri);
+
+    const Admitted admitted = std::move(it->admitted);
+
+    it->waiter->_queued = false;
+    queue.erase(it);
+    --stats.queued;
+    ++stats.rejected;
+
+    admitted(nullptr);
+}
+
+// on idle, since capacity is freed from peer's destructor
+void PeerAdmission::Private::scheduleDispatch()
+{
+    if(dispatchSource)
+        return;
+
+    dispatchSource.reset(g_idle_source_new());
+    g_source_set_callback(
+        dispatchSource.get(),
+        [] (gpointer userData) -> gboolean {
+            Private* self = static_cast<Private*>(userData);
+            self->dispatchSource.reset();
+            self->dispatch();
+            return G_SOURCE_REMOVE;
+        }, this, nullptr);
+    g_source_attach(dispatchSource.get(), context);
+}
+
+// waiters are admitted in arrival order,
+// skipping ones with URI still at per URI limit
+void PeerAdmission::Private::dispatch()
+{
+    // Admitted callback could destroy PeerAdmission
+    std::shared_ptr<Private> self = weakThis.lock();
+
+    for(;;) {
+        auto it = std::find_if(
+            queue.begin(), queue.end(),
+            [this] (const Entry& entry) { return hasCapacity(entry.uri); });
+        if(it == queue.end())
+            break;
+
+        const Admitted admitted = std::move(it->admitted);
+        TicketPtr ticket = acquire(it->uri);
+
+        if(it->timeoutSource)
+            g_source_destroy(it->timeoutSource.get());
+
+        it->waiter->_queued = false;
+        queue.erase(it);
+        --stats.queued;
+
+        admitted(std::move(ticket));
+
+        if(self.use_count() == 1)
+            break;
+    }
+}
+
+
+PeerAdmission::PeerAdmission(const Config& config) noexcept :
+    _p(std::make_shared<Private>(config))
+{
+    _p->weakThis = _p;
+}
+
+PeerAdmission::~PeerAdmission()
+{
+}
+
+const PeerAdmission::Config& PeerAdmission::config() const noexcept
+{
+    return _p->config;
+}
+
+PeerAdmission::TicketPtr PeerAdmission::admit(const std::string& uri) noexcept
+{
+    // pending dispatch means there are waiters to be admitted first
+    if(_p->dispatchSource || !_p->hasCapacity(uri))
+        return nullptr;
+
+    return _p->acquire(uri);
+}
+
+PeerAdmission::WaiterPtr PeerAdmission::enqueue(
+    const std::string& uri,
+    const Admitted& admitted) noexcept
+{
+    if(_p->queue.size() >= _p->config.maxQueued) {
+        Log()->debug("Peer admission queue is full. Uri: {}", uri);
+        ++_p->stats.rejected;
+        return nullptr;
+    }
+
+    auto it = _p->queue.emplace(
+        _p->queue.end(),
+        Private::Entry { uri, admitted, nullptr, nullptr });
+
+    auto waiter = std::make_unique<Private::AdmissionWaiter>(_p->weakThis, it);
+    it->waiter = waiter.get();
+
+    ++_p->stats.queued;
+    ++_p->stats.waited;
+
+    if(_p->config.queueTimeout) {
+        struct TimeoutData
+        {
+            Private* owner;
+            Private::Queue::iterator entry;
+        };
+
+        it->timeoutSource.reset(g_timeout_source_new_seconds(_p->config.queueTimeout));
+        g_source_set_callback(
+            it->timeoutSource.get(),
+            [] (gpointer userData) -> gboolean {
+                TimeoutData* data = static_cast<TimeoutData*>(userData);
+                // Admitted callback could destroy PeerAdmission
+                std::shared_ptr<Private> owner = data->owner->weakThis.lock();
+                owner->timeout(data->entry);
+                return G_SOURCE_REMOVE;
+            },
+            new TimeoutData { _p.get(), it },
+            [] (gpointer userData) {
+                delete static_cast<TimeoutData*>(userData);
+            });
+        g_source_attach(it->timeoutSource.get(), _p->context);
+    }
+
+    if(_p->hasCapacity(uri))
+        _p->scheduleDispatch();
+
+    return std::move(waiter);
+}
+
+PeerAdmission::Stats PeerAdmission::stats() const noexcept
+{
+    return _p->stats;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <functional>
+
+
+// Limits amount of simultaneously alive WebRTC peers globally and per URI.
+// Requests exceeding limits can wait in short bounded queue
+// until capacity is freed by destroyed peers.
+// Should be used from thread with GMainContext it was created on.
+class PeerAdmission
+{
+public:
+    struct Config
+    {
+        // 0 - unlimited
+        unsigned maxPeers = 0;
+        unsigned maxPeersPerUri = 0;
+
+        // requests waiting for capacity, 0 - no queue, i.e. reject right away
+        unsigned maxQueued = 16;
+        unsigned queueTimeout = 3; // seconds
+
+        // sent to client with 503 reply, 0 - not sent
+        unsigned retryAfter = 5; // seconds
+    };
+
+    struct Stats
+    {
+        unsigned activePeers;
+        unsigned queued;
+        unsigned long long admitted; // including ones admitted after waiting
+        unsigned long long waited;
+        unsigned long long rejected; // queue full or timed out
+    };
+
+    // holds capacity while alive, should be destroyed together with peer
+    struct Ticket
+    {
+        virtual ~Ticket() {}
+    };
+    typedef std::unique_ptr<Ticket> TicketPtr;
+
+    // queue entry, destroying it cancels waiting
+    struct Waiter
+    {
+        virtual ~Waiter() {}
+    };
+    typedef std::unique_ptr<Waiter> WaiterPtr;
+
+    // called from event loop with nullptr if waiting timed out
+    typedef std::function<void (TicketPtr&&)> Admitted;
+
+    explicit PeerAdmission(const Config&) noexcept;
+    ~PeerAdmission();
+
+    const Config& config() const noexcept;
+
+    // nullptr if there is no free capacity
+    TicketPtr admit(const std::string& uri) noexcept;
+
+    // nullptr if queue is full
+    WaiterPtr enqueue(const std::string& uri, const Admitted&) noexcept;
+
+    Stats stats() const noexcept;
+
+private:
+    struct Private;
+    std::shared_ptr<Private> _p;
+};
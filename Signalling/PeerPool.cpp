@@ -0,0 +1,418 @@
+#include "PeerPool.h"
+
+#include <cassert>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+
+
+namespace {
+
+const auto Log = ServerSessionLog;
+
+enum {
+    SHRINK_INTERVAL = 30, // seconds
+};
+
+// peer and everything it reported before been handed out
+struct PooledPeer
+{
+    std::unique_ptr<WebRTCPeer> peer;
+
+    bool prepared = false;
+    std::vector<std::pair<unsigned, std::string>> iceCandidates;
+    bool eos = false;
+
+    bool handedOut = false;
+
+    // set when handed out and recorded events are replayed
+    bool replayed = false;
+    WebRTCPeer::PreparedCallback preparedCallback;
+    WebRTCPeer::IceCandidateCallback iceCandidateCallback;
+    WebRTCPeer::EosCallback eosCallback;
+
+    void onPrepared()
+    {
+        prepared = true;
+        if(replayed && preparedCallback)
+            preparedCallback();
+    }
+    void onIceCandidate(unsigned mlineIndex, const std::string& candidate)
+    {
+        if(replayed && iceCandidateCallback)
+            iceCandidateCallback(mlineIndex, candidate);
+        else
+            iceCandidates.emplace_back(mlineIndex, candidate);
+    }
+    void onEos()
+    {
+        eos = true;
+        if(replayed && eosCallback)
+            eosCallback();
+    }
+
+    void replay();
+};
+
+// should be called with extra reference to this,
+// since any callback could destroy handed out peer
+void PooledPeer::replay()
+{
+    replayed = true;
+
+    const WebRTCPeer::PreparedCallback onPrepared =
+        prepared ? preparedCallback : WebRTCPeer::PreparedCallback();
+    const std::vector<std::pair<unsigned, std::string>> candidates = std::move(iceCandidates);
+    const WebRTCPeer::IceCandidateCallback onIceCandidate = iceCandidateCallback;
+    const WebRTCPeer::EosCallback onEos = eos ? eosCallback : WebRTCPeer::EosCallback();
+
+    iceCandidates.clear();
+
+    if(onPrepared) {
+        onPrepared();
+        if(!peer)
+            return;
+    }
+
+    if(onIceCandidate) {
+        for(const auto& candidate: candidates) {
+            onIceCandidate(candidate.first, candidate.second);
+            if(!peer)
+                return;
+        }
+    }
+
+    if(onEos)
+        onEos();
+}
+
+// Replays events of pooled peer on the next loop iteration after prepare(),
+// since ServerSession doesn't expect callbacks from inside prepare().
+class PrewarmedPeer : public WebRTCPeer
+{
+public:
+    PrewarmedPeer(const std::shared_ptr<PooledPeer>& pooledPeer, GMainContext* context) :
+        _pooledPeer(pooledPeer), _context(context)
+        { _pooledPeer->handedOut = true; }
+
+    ~PrewarmedPeer()
+    {
+        if(_replaySource)
+            g_source_destroy(_replaySource.get());
+
+        _pooledPeer->peer.reset();
+    }
+
+    void prepare(
+        const IceServers&,
+        const PreparedCallback& prepared,
+        const IceCandidateCallback& iceCandidate,
+        const EosCallback& eos) noexcept override
+    {
+        _pooledPeer->preparedCallback = prepared;
+        _pooledPeer->iceCandidateCallback = iceCandidate;
+        _pooledPeer->eosCallback = eos;
+
+        _replaySource.reset(g_idle_source_new());
+        g_source_set_callback(
+            _replaySource.get(),
+            [] (gpointer userData) -> gboolean {
+                PrewarmedPeer* self = static_cast<PrewarmedPeer*>(userData);
+                std::shared_ptr<PooledPeer> pooledPeer = self->_pooledPeer;
+
+                self->_replaySource.reset();
+
+                pooledPeer->replay();
+
+                return G_SOURCE_REMOVE;
+            }, this, nullptr);
+        g_source_attach(_replaySource.get(), _context);
+    }
+
+    const std::string& sdp() noexcept override
+        { return _pooledPeer->peer->sdp(); }
+
+    void setRemoteSdp(const std::string& sdp) noexcept override
+        { _pooledPeer->peer->setRemoteSdp(sdp); }
+
+    void addIceCandidate(unsigned mlineIndex, const std::string& candidate) noexcept override
+        { _pooledPeer->peer->addIceCandidate(mlineIndex, candidate); }
+
+    void play() noexcept override
+        { _pooledPeer->peer->play(); }
+
+    void stop() noexcept override
+        { _pooledPeer->peer->stop(); }
+
+private:
+    const std::shared_ptr<PooledPeer> _pooledPeer;
+    GMainContext* _context;
+    GSourcePtr _replaySource;
+};
+
+// peers prepared with the same ICE servers
+struct IcePool
+{
+    unsigned targetSize = 0;
+    // there was a miss since the last shrink
+    bool missed = false;
+
+    std::deque<std::shared_ptr<PooledPeer>> peers;
+};
+
+struct UriPool
+{
+    unsigned minSize;
+    unsigned maxSize;
+
+    std::map<WebRTCPeer::IceServers, IcePool> icePools;
+};
+
+}
+
+struct PeerPool::Private
+{
+    Private(const CreatePeer&, const WebRTCPeer::IceServers&);
+    ~Private();
+
+    std::shared_ptr<PooledPeer> createPooledPeer(
+        const std::string& uri,
+        const WebRTCPeer::IceServers&);
+    void scheduleReplenish();
+    bool replenish();
+    void shrink();
+
+    CreatePeer createPeer;
+    WebRTCPeer::IceServers iceServers;
+    GMainContext* context;
+    const std::thread::id thread;
+
+    std::unordered_map<std::string, UriPool> pools;
+
+    GSourcePtr replenishSource;
+    GSourcePtr shrinkSource;
+
+    Stats stats {};
+};
+
+PeerPool::Private::Private(
+    const CreatePeer& createPeer,
+    const WebRTCPeer::IceServers& iceServers) :
+    createPeer(createPeer), iceServers(iceServers),
+    context(g_main_context_get_thread_default()),
+    thread(std::this_thread::get_id())
+{
+    shrinkSource.reset(g_timeout_source_new_seconds(SHRINK_INTERVAL));
+    g_source_set_callback(
+        shrinkSource.get(),
+        [] (gpointer userData) -> gboolean {
+            static_cast<Private*>(userData)->shrink();
+            return G_SOURCE_CONTINUE;
+        }, this, nullptr);
+    g_source_attach(shrinkSource.get(), context);
+}
+
+PeerPool::Private::~Private()
+{
+    if(replenishSource)
+        g_source_destroy(replenishSource.get());
+
+    g_source_destroy(shrinkSource.get());
+}
+
+std::shared_ptr<PooledPeer> PeerPool::Private::createPooledPeer(
+    const std::string& uri,
+    const WebRTCPeer::IceServers& iceServers)
+{
+    std::unique_ptr<WebRTCPeer> peer = createPeer(uri);
+    if(!peer)
+        return nullptr;
+
+    std::shared_ptr<PooledPeer> pooledPeer = std::make_shared<PooledPeer>();
+    pooledPeer->peer = std::move(peer);
+
+    // pooled peer owns peer, so raw pointer is safe
+    PooledPeer* rawPooledPeer = pooledPeer.get();
+    pooledPeer->peer->prepare(
+        iceServers,
+        [rawPooledPeer] () {
+            rawPooledPeer->onPrepared();
+        },
+        [rawPooledPeer] (unsigned mlineIndex, const std::string& candidate) {
+            rawPooledPeer->onIceCandidate(mlineIndex, candidate);
+        },
+        [this, rawPooledPeer] () {
+            // handed out peer could outlive pool
+            if(!rawPooledPeer->handedOut)
+                scheduleReplenish();
+
+            rawPooledPeer->onEos();
+        });
+
+    return pooledPeer;
+}
+
+// one peer per iteration on idle, to not stall the loop
+void PeerPool::Private::scheduleReplenish()
+{
+    if(replenishSource)
+        return;
+
+    replenishSource.reset(g_idle_source_new());
+    g_source_set_callback(
+        replenishSource.get(),
+        [] (gpointer userData) -> gboolean {
+            Private* self = static_cast<Private*>(userData);
+            if(self->replenish())
+                return G_SOURCE_CONTINUE;
+
+            self->replenishSource.reset();
+            return G_SOURCE_REMOVE;
+        }, this, nullptr);
+    g_source_attach(replenishSource.get(), context);
+}
+
+// returns true if there is more to do
+bool PeerPool::Private::replenish()
+{
+    for(auto& pair: pools) {
+        const std::string& uri = pair.first;
+
+        for(auto& icePair: pair.second.icePools) {
+            IcePool& icePool = icePair.second;
+
+            // failed pipelines are useless
+            const size_t size = icePool.peers.size();
+            icePool.peers.erase(
+                std::remove_if(
+                    icePool.peers.begin(),
+                    icePool.peers.end(),
+                    [] (const std::shared_ptr<PooledPeer>& peer) { return peer->eos; }),
+                icePool.peers.end());
+            stats.pooled -= static_cast<unsigned>(size - icePool.peers.size());
+
+            if(icePool.peers.size() >= icePool.targetSize)
+                continue;
+
+            std::shared_ptr<PooledPeer> pooledPeer = createPooledPeer(uri, icePair.first);
+            if(!pooledPeer) {
+                Log()->warn("Fail create pooled peer. Uri: {}", uri);
+                continue;
+            }
+
+            icePool.peers.emplace_back(std::move(pooledPeer));
+            ++stats.pooled;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// peers prepared with not default ICE servers are kept only while requested
+void PeerPool::Private::shrink()
+{
+    for(auto& pair: pools) {
+        UriPool& pool = pair.second;
+
+        for(auto it = pool.icePools.begin(); it != pool.icePools.end();) {
+            const bool defaultIceServers = it->first == iceServers;
+            IcePool& icePool = it->second;
+
+            const unsigned minSize = defaultIceServers ? pool.minSize : 0;
+            if(!icePool.missed && icePool.targetSize > minSize)
+                --icePool.targetSize;
+            icePool.missed = false;
+
+            while(icePool.peers.size() > icePool.targetSize) {
+                icePool.peers.pop_back();
+                --stats.pooled;
+            }
+
+            if(!defaultIceServers && !icePool.targetSize)
+                it = pool.icePools.erase(it);
+            else
+                ++it;
+        }
+    }
+}
+
+PeerPool::PeerPool(
+    const CreatePeer& createPeer,
+    const WebRTCPeer::IceServers& iceServers) noexcept :
+    _p(std::make_unique<Private>(createPeer, iceServers))
+{
+}
+
+PeerPool::~PeerPool()
+{
+}
+
+void PeerPool::addUri(const std::string& uri, unsigned minSize, unsigned maxSize) noexcept
+{
+    assert(std::this_thread::get_id() == _p->thread);
+
+    UriPool& pool = _p->pools[uri];
+    pool.minSize = minSize;
+    pool.maxSize = std::max(minSize, maxSize);
+    pool.icePools[_p->iceServers].targetSize = minSize;
+
+    _p->scheduleReplenish();
+}
+
+std::unique_ptr<WebRTCPeer> PeerPool::takePeer(
+    const std::string& uri,
+    const WebRTCPeer::IceServers& iceServers) noexcept
+{
+    assert(std::this_thread::get_id() == _p->thread);
+
+    auto it = _p->pools.find(uri);
+    if(it == _p->pools.end())
+        return nullptr;
+
+    UriPool& pool = it->second;
+    IcePool& icePool = pool.icePools[iceServers];
+
+    std::shared_ptr<PooledPeer> pooledPeer;
+    while(!icePool.peers.empty() && !pooledPeer) {
+        pooledPeer = std::move(icePool.peers.front());
+        icePool.peers.pop_front();
+        --_p->stats.pooled;
+
+        if(pooledPeer->eos)
+            pooledPeer.reset();
+    }
+
+    if(!pooledPeer) {
+        ++_p->stats.misses;
+        icePool.missed = true;
+        if(icePool.targetSize < pool.maxSize)
+            ++icePool.targetSize;
+
+        Log()->debug("No pooled peer. Uri: {}", uri);
+    }
+
+    _p->scheduleReplenish();
+
+    if(!pooledPeer)
+        return nullptr;
+
+    ++_p->stats.hits;
+
+    return std::make_unique<PrewarmedPeer>(pooledPeer, _p->context);
+}
+
+PeerPool::Stats PeerPool::stats() const noexcept
+{
+    assert(std::this_thread::get_id() == _p->thread);
+
+    return _p->stats;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "RtStreaming/WebRTCPeer.h"
+
+
+// Keeps peers for configured URIs constructed and prepared in advance,
+// so DESCRIBE reply doesn't wait for pipeline startup and ICE gathering.
+// Not thread safe: should be used only from thread with GMainContext
+// the pool was created on (CreatePeer is called on that thread too).
+class PeerPool
+{
+public:
+    typedef std::function<std::unique_ptr<WebRTCPeer> (const std::string& uri)> CreatePeer;
+
+    struct Stats
+    {
+        unsigned pooled;
+        unsigned long long hits;
+        unsigned long long misses;
+    };
+
+    // peers are prewarmed with iceServers until sessions request other ones
+    PeerPool(const CreatePeer&, const WebRTCPeer::IceServers&) noexcept;
+    ~PeerPool();
+
+    // at least minSize peers are kept prepared,
+    // every miss increases that amount up to maxSize,
+    // every shrink interval without misses decreases it back to minSize
+    void addUri(const std::string& uri, unsigned minSize, unsigned maxSize) noexcept;
+
+    // returns peer prepared for URI with the same ICE servers,
+    // nullptr if there is no such peer (and peer should be created as usual)
+    std::unique_ptr<WebRTCPeer> takePeer(
+        const std::string& uri,
+        const WebRTCPeer::IceServers&) noexcept;
+
+    Stats stats() const noexcept;
+
+private:
+    struct Private;
+    std::unique_ptr<Private> _p;
+};
@@ -0,0 +1,434 @@
+#include "PeerWorkers.h"
+
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+
+
+namespace {
+
+const auto Log = ServerSessionLog;
+
+typedef std::function<void ()> Action;
+
+// action is run on thread owning context
+void Invoke(GMainContext* context, Action&& action)
+{
+    g_main_context_invoke_full(
+        context,
+        G_PRIORITY_DEFAULT,
+        [] (gpointer userData) -> gboolean {
+            (*static_cast<Action*>(userData))();
+            return G_SOURCE_REMOVE;
+        },
+        new Action(std::move(action)),
+        [] (gpointer userData) {
+            delete static_cast<Action*>(userData);
+        });
+}
+
+struct Worker
+{
+    GMainContextPtr context;
+    GMainLoopPtr loop;
+    std::thread thread;
+
+    // accessed from owner's loop only
+    unsigned peers = 0;
+};
+
+struct Counters
+{
+    std::atomic<unsigned long long> created { 0 };
+    std::atomic<unsigned long long> failed { 0 };
+
+    // accessed from owner's loop only
+    unsigned pending = 0;
+    unsigned long long rejected = 0;
+};
+
+// dispatched when ready time is set from worker
+gboolean DispatchEvents(GSource* source, GSourceFunc callback, gpointer userData)
+{
+    g_source_set_ready_time(source, -1);
+
+    return callback(userData);
+}
+
+GSourceFuncs EventsSourceFuncs = {
+    nullptr,
+    nullptr,
+    DispatchEvents,
+    nullptr,
+};
+
+// shared by proxy on owner's loop and worker
+struct PeerState : public std::enable_shared_from_this<PeerState>
+{
+    explicit PeerState(const std::shared_ptr<Counters>& counters) :
+        counters(counters) {}
+
+    bool isDestroyed();
+    void post(Action&&);
+    void dispatchEvents();
+    void settle();
+
+    const std::shared_ptr<Counters> counters;
+
+    // worker only
+    std::unique_ptr<WebRTCPeer> peer;
+
+    // owner's loop only
+    WebRTCPeer::PreparedCallback prepared;
+    WebRTCPeer::IceCandidateCallback iceCandidate;
+    WebRTCPeer::EosCallback eos;
+    std::string sdp;
+    bool settled = false;
+    GSourcePtr eventsSource;
+
+    // events from worker waiting for owner's loop
+    std::mutex eventsMutex;
+    std::deque<Action> events;
+    bool destroyed = false; // changed on owner's loop with eventsMutex locked
+};
+
+bool PeerState::isDestroyed()
+{
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    return destroyed;
+}
+
+// called on worker
+void PeerState::post(Action&& event)
+{
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    if(destroyed)
+        return;
+
+    events.emplace_back(std::move(event));
+    g_source_set_ready_time(eventsSource.get(), 0);
+}
+
+void PeerState::dispatchEvents()
+{
+    // any event could destroy proxy
+    std::shared_ptr<PeerState> self = shared_from_this();
+
+    std::deque<Action> pendingEvents;
+    {
+        std::lock_guard<std::mutex> lock(eventsMutex);
+        pendingEvents.swap(events);
+    }
+
+    for(Action& event: pendingEvents) {
+        if(destroyed)
+            break;
+
+        event();
+    }
+}
+
+void PeerState::settle()
+{
+    if(settled)
+        return;
+
+    settled = true;
+    --counters->pending;
+}
+
+// proxy living on owner's loop
+class WorkerPeer : public WebRTCPeer
+{
+public:
+    WorkerPeer(
+        const std::shared_ptr<Counters>&,
+        GMainContext* ownerContext,
+        const std::shared_ptr<Worker>&,
+        const PeerWorkers::CreatePeer&,
+        const std::string& uri);
+    ~WorkerPeer();
+
+    void prepare(
+        const IceServers&,
+        const PreparedCallback&,
+        const IceCandidateCallback&,
+        const EosCallback&) noexcept override;
+
+    const std::string& sdp() noexcept override
+        { return _state->sdp; }
+
+    void setRemoteSdp(const std::string&) noexcept override;
+    void addIceCandidate(unsigned mlineIndex, const std::string& candidate) noexcept override;
+    void play() noexcept override;
+    void stop() noexcept override;
+
+private:
+    const std::shared_ptr<Worker> _worker;
+    std::shared_ptr<PeerState> _state;
+};
+
+WorkerPeer::WorkerPeer(
+    const std::shared_ptr<Counters>& counters,
+    GMainContext* ownerContext,
+    const std::shared_ptr<Worker>& worker,
+    const PeerWorkers::CreatePeer& createPeer,
+    const std::string& uri) :
+    _worker(worker), _state(std::make_shared<PeerState>(counters))
+{
+    ++_worker->peers;
+    ++counters->pending;
+
+    _state->eventsSource.reset(g_source_new(&EventsSourceFuncs, sizeof(GSource)));
+    g_source_set_callback(
+        _state->eventsSource.get(),
+        [] (gpointer userData) -> gboolean {
+            static_cast<PeerState*>(userData)->dispatchEvents();
+            return G_SOURCE_CONTINUE;
+        }, _state.get(), nullptr);
+    g_source_attach(_state->eventsSource.get(), ownerContext);
+
+    std::shared_ptr<PeerState> state = _state;
+    Invoke(
+        _worker->context.get(),
+        [state, createPeer, uri] () {
+            if(state->isDestroyed())
+                return;
+
+            state->peer = createPeer(uri);
+
+            if(state->peer)
+                ++state->counters->created;
+            else {
+                ++state->counters->failed;
+                // logger is not thread safe
+                state->post([uri] () {
+                    Log()->warn("Fail create peer. Uri: {}", uri);
+                });
+            }
+        });
+}
+
+// peer is destroyed on worker
+WorkerPeer::~WorkerPeer()
+{
+    std::deque<Action> events;
+    {
+        std::lock_guard<std::mutex> lock(_state->eventsMutex);
+        _state->destroyed = true;
+        events.swap(_state->events);
+    }
+
+    g_source_destroy(_state->eventsSource.get());
+
+    _state->settle();
+    --_worker->peers;
+
+    std::shared_ptr<PeerState> state = std::move(_state);
+    Invoke(
+        _worker->context.get(),
+        [state] () {
+            state->peer.reset();
+        });
+}
+
+void WorkerPeer::prepare(
+    const IceServers& iceServers,
+    const PreparedCallback& prepared,
+    const IceCandidateCallback& iceCandidate,
+    const EosCallback& eos) noexcept
+{
+    _state->prepared = prepared;
+    _state->iceCandidate = iceCandidate;
+    _state->eos = eos;
+
+    std::shared_ptr<PeerState> state = _state;
+    Invoke(
+        _worker->context.get(),
+        [state, iceServers] () {
+            // peer is owned by state, and events are run by state,
+            // so raw pointer is safe
+            PeerState* rawState = state.get();
+
+            if(!state->peer) {
+                rawState->post([rawState] () {
+                    rawState->settle();
+                    if(rawState->eos)
+                        rawState->eos();
+                });
+                return;
+            }
+
+            state->peer->prepare(
+                iceServers,
+                [rawState] () {
+                    const std::string sdp = rawState->peer->sdp();
+                    rawState->post([rawState, sdp] () {
+                        rawState->sdp = sdp;
+                        rawState->settle();
+                        if(rawState->prepared)
+                            rawState->prepared();
+                    });
+                },
+                [rawState] (unsigned mlineIndex, const std::string& candidate) {
+                    rawState->post([rawState, mlineIndex, candidate] () {
+                        if(rawState->iceCandidate)
+                            rawState->iceCandidate(mlineIndex, candidate);
+                    });
+                },
+                [rawState] () {
+                    rawState->post([rawState] () {
+                        rawState->settle();
+                        if(rawState->eos)
+                            rawState->eos();
+                    });
+                });
+        });
+}
+
+void WorkerPeer::setRemoteSdp(const std::string& sdp) noexcept
+{
+    std::shared_ptr<PeerState> state = _state;
+    Invoke(
+        _worker->context.get(),
+        [state, sdp] () {
+            if(state->peer)
+                state->peer->setRemoteSdp(sdp);
+        });
+}
+
+void WorkerPeer::addIceCandidate(unsigned mlineIndex, const std::string& candidate) noexcept
+{
+    std::shared_ptr<PeerState> state = _state;
+    Invoke(
+        _worker->context.get(),
+        [state, mlineIndex, candidate] () {
+            if(state->peer)
+                state->peer->addIceCandidate(mlineIndex, candidate);
+        });
+}
+
+void WorkerPeer::play() noexcept
+{
+    std::shared_ptr<PeerState> state = _state;
+    Invoke(
+        _worker->context.get(),
+        [state] () {
+            if(state->peer)
+                state->peer->play();
+        });
+}
+
+void WorkerPeer::stop() noexcept
+{
+    std::shared_ptr<PeerState> state = _state;
+    Invoke(
+        _worker->context.get(),
+        [state] () {
+            if(state->peer)
+                state->peer->stop();
+        });
+}
+
+}
+
+struct PeerWorkers::Private
+{
+    Private(unsigned maxPending);
+
+    const unsigned maxPending;
+    GMainContextPtr context;
+
+    std::vector<std::shared_ptr<Worker>> workers;
+
+    const std::shared_ptr<Counters> counters;
+};
+
+PeerWorkers::Private::Private(unsigned maxPending) :
+    maxPending(maxPending),
+    context(g_main_context_ref_thread_default()),
+    counters(std::make_shared<Counters>())
+{
+}
+
+
+PeerWorkers::PeerWorkers(unsigned threads, unsigned maxPending) noexcept :
+    _p(std::make_unique<Private>(maxPending))
+{
+    for(unsigned i = 0; i < std::max(threads, 1u); ++i) {
+        std::shared_ptr<Worker> worker = std::make_shared<Worker>();
+        worker->context.reset(g_main_context_new());
+        worker->loop.reset(g_main_loop_new(worker->context.get(), FALSE));
+
+        Worker* rawWorker = worker.get();
+        worker->thread = std::thread(
+            [rawWorker] () {
+                g_main_context_push_thread_default(rawWorker->context.get());
+                g_main_loop_run(rawWorker->loop.get());
+                g_main_context_pop_thread_default(rawWorker->context.get());
+            });
+
+        _p->workers.emplace_back(std::move(worker));
+    }
+}
+
+PeerWorkers::~PeerWorkers()
+{
+    // queued after everything already posted to worker,
+    // so released peers are destroyed before the loop is quit
+    for(const std::shared_ptr<Worker>& worker: _p->workers) {
+        GMainLoop* loop = worker->loop.get();
+        Invoke(
+            worker->context.get(),
+            [loop] () {
+                g_main_loop_quit(loop);
+            });
+    }
+
+    for(const std::shared_ptr<Worker>& worker: _p->workers)
+        worker->thread.join();
+}
+
+std::unique_ptr<WebRTCPeer> PeerWorkers::createPeer(
+    const CreatePeer& createPeer,
+    const std::string& uri) noexcept
+{
+    if(_p->maxPending && _p->counters->pending >= _p->maxPending) {
+        Log()->debug("Too many peers pending preparation. Uri: {}", uri);
+        ++_p->counters->rejected;
+        return nullptr;
+    }
+
+    const std::shared_ptr<Worker>& worker =
+        *std::min_element(
+            _p->workers.begin(),
+            _p->workers.end(),
+            [] (const std::shared_ptr<Worker>& l, const std::shared_ptr<Worker>& r) {
+                return l->peers < r->peers;
+            });
+
+    return
+        std::make_unique<WorkerPeer>(
+            _p->counters,
+            _p->context.get(),
+            worker,
+            createPeer,
+            uri);
+}
+
+PeerWorkers::Stats PeerWorkers::stats() const noexcept
+{
+    return Stats {
+        _p->counters->pending,
+        _p->counters->created,
+        _p->counters->failed,
+        _p->counters->rejected,
+    };
+}
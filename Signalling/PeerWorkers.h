@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "RtStreaming/WebRTCPeer.h"
+
+
+// Fixed set of threads, each running own GMainContext,
+// constructing and preparing WebRTC peers off the signalling loop,
+// so slow pipeline build, blocking upstream connect or ICE gathering
+// doesn't stall unrelated connections.
+// Since GStreamer peer is bound to GMainContext it was prepared on,
+// peer lives on its worker for the whole life: returned peers are proxies
+// to be used on GMainContext the pool was created on, every call is forwarded
+// to the worker and peer is destroyed there. Callbacks are delivered back
+// through queue owned by proxy and dropped with it, so they are never called
+// after proxy is destroyed.
+class PeerWorkers
+{
+public:
+    // called on worker thread, so should be thread safe
+    typedef std::function<std::unique_ptr<WebRTCPeer> (const std::string& uri)> CreatePeer;
+
+    struct Stats
+    {
+        unsigned pending; // being constructed or prepared
+        unsigned long long created;
+        unsigned long long failed;
+        unsigned long long rejected; // too many pending
+    };
+
+    // maxPending - 0 means unlimited
+    PeerWorkers(unsigned threads, unsigned maxPending) noexcept;
+    // waits workers destroy already released peers and exit,
+    // so should outlive peers it created
+    ~PeerWorkers();
+
+    // nullptr if there are too many pending peers,
+    // construction failure is reported as EOS after prepare()
+    std::unique_ptr<WebRTCPeer> createPeer(const CreatePeer&, const std::string& uri) noexcept;
+
+    Stats stats() const noexcept;
+
+private:
+    struct Private;
+    std::unique_ptr<Private> _p;
+};
@@ -1,35 +1,90 @@
 ﻿#include "ServerSession.h"
 
-#include <list>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <map>
 
+#include <CxxPtr/GlibPtr.h>
+
+#include "RtspParser/RtspParser.h"
+#include "RtspParser/RtspSerialize.h"
 #include "RtspSession/StatusCode.h"
 
 #include "Log.h"
+#include "SlotMap.h"
+#include "PeerAdmission.h"
+#include "PeerWorkers.h"
+#include "PeerPool.h"
+#include "SessionTimings.h"
 
 
 namespace {
 
 struct MediaSession
 {
+    ~MediaSession()
+    {
+        if(iceFlushSource)
+            g_source_destroy(iceFlushSource.get());
+    }
+
     bool recorder = false;
     std::string uri;
-    std::unique_ptr<rtsp::Request> createRequest; // describe or announce
+    // should outlive peer
+    PeerAdmission::TicketPtr admissionTicket;
     std::unique_ptr<WebRTCPeer> localPeer;
+
+    // not sent yet local ICE candidates
+    std::string iceCandidates;
+    unsigned iceCandidatesCount = 0;
+    GSourcePtr iceFlushSource;
+
+    // DESCRIBE/ANNOUNCE receiving time
+    SessionTimings::Clock::time_point requestTime;
+    // bit per already recorded SessionTimings::Phase
+    unsigned timedPhases = 0;
 };
 
-typedef std::map<rtsp::SessionId, std::unique_ptr<MediaSession>> MediaSessions;
+typedef signalling::SlotMap<MediaSession> MediaSessions;
+typedef MediaSessions::Id MediaSessionId;
 
-struct RequestInfo
+// pending describe/announce requests waiting for peer preparation
+typedef std::map<rtsp::CSeq, MediaSessionId> Requests;
+
+// describe requests waiting for peer capacity
+struct QueuedRequest
 {
     std::unique_ptr<rtsp::Request> requestPtr;
-    const rtsp::SessionId session;
+    SessionTimings::Clock::time_point requestTime;
+    PeerAdmission::WaiterPtr waiter;
 };
 
-typedef std::map<rtsp::CSeq, RequestInfo> Requests;
+typedef std::map<rtsp::CSeq, QueuedRequest> QueuedRequests;
 
 const auto Log = ServerSessionLog;
 
+inline rtsp::SessionId ToSessionId(MediaSessionId id)
+{
+    return std::to_string(id);
+}
+
+bool ParseSessionId(const rtsp::SessionId& session, MediaSessionId* id)
+{
+    if(session.empty() || !std::isdigit(static_cast<unsigned char>(session[0])))
+        return false;
+
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long value = std::strtoull(session.c_str(), &end, 10);
+    if(*end != '\0' || errno == ERANGE)
+        return false;
+
+    *id = value;
+
+    return true;
+}
+
 }
 
 struct ServerSession::Private
@@ -51,25 +106,54 @@ struct ServerSession::Private
 
     std::deque<std::string> iceServers;
 
+    unsigned iceCoalescingWindow = 0;
+    unsigned maxCoalescedIceCandidates = 0;
+
+    std::shared_ptr<PeerAdmission> peerAdmission;
+    std::shared_ptr<OfferStructureStats> offerStructureStats;
+    std::shared_ptr<PeerWorkers> peerWorkers;
+    std::shared_ptr<PeerPool> peerPool;
+    std::shared_ptr<SessionTimings> sessionTimings;
+
     Requests describeRequests;
     Requests announceRequests;
+    QueuedRequests queuedDescribeRequests;
     MediaSessions mediaSessions;
 
     bool recordEnabled()
         { return createRecordPeer ? true : false; }
 
-    std::string nextSession()
-        { return std::to_string(_nextSession++); }
+    MediaSession* findMediaSession(const rtsp::Request&, MediaSessionId*);
+
+    bool describe(
+        std::unique_ptr<rtsp::Request>&,
+        SessionTimings::Clock::time_point requestTime,
+        PeerAdmission::TicketPtr&&);
+    bool describe(
+        std::unique_ptr<rtsp::Request>&,
+        SessionTimings::Clock::time_point requestTime,
+        PeerAdmission::TicketPtr&&,
+        std::unique_ptr<WebRTCPeer>&&);
+    bool queueDescribe(
+        std::unique_ptr<rtsp::Request>&,
+        SessionTimings::Clock::time_point requestTime);
+    void describeAdmitted(rtsp::CSeq describeRequestCSeq, PeerAdmission::TicketPtr&&);
+    bool announce(
+        std::unique_ptr<rtsp::Request>&,
+        SessionTimings::Clock::time_point requestTime,
+        PeerAdmission::TicketPtr&&,
+        std::unique_ptr<WebRTCPeer>&&);
+    void sendServiceUnavailable(rtsp::CSeq);
+
+    void recordPhase(MediaSession*, SessionTimings::Phase);
 
     void streamerPrepared(rtsp::CSeq describeRequestCSeq);
     void recorderPrepared(rtsp::CSeq announceRequestCSeq);
     void iceCandidate(
-        const rtsp::SessionId&,
+        MediaSessionId,
         unsigned, const std::string&);
-    void eos(const rtsp::SessionId& session);
-
-private:
-    unsigned _nextSession = 1;
+    void flushIceCandidates(MediaSessionId, MediaSession*);
+    void eos(MediaSessionId);
 };
 
 struct ServerSession::Private::AutoEraseRequest
@@ -119,75 +203,81 @@ ServerSession::Private::Private(
 {
 }
 
+MediaSession* ServerSession::Private::findMediaSession(
+    const rtsp::Request& request,
+    MediaSessionId* id)
+{
+    if(!ParseSessionId(RequestSession(request), id))
+        return nullptr;
+
+    return mediaSessions.find(*id);
+}
+
 void ServerSession::Private::streamerPrepared(rtsp::CSeq describeRequestCSeq)
 {
     auto requestIt = describeRequests.find(describeRequestCSeq);
-    if(describeRequests.end() == requestIt ||
-       rtsp::Method::DESCRIBE != requestIt->second.requestPtr->method)
-    {
+    if(describeRequests.end() == requestIt) {
         owner->disconnect();
         return;
     }
 
     AutoEraseRequest autoEraseRequest(this, requestIt);
 
-    RequestInfo& requestInfo = requestIt->second;
-    const rtsp::SessionId& session = requestInfo.session;
+    const MediaSessionId id = requestIt->second;
 
-    auto it = mediaSessions.find(session);
-    if(mediaSessions.end() == it || it->second->recorder) {
+    MediaSession* mediaSession = mediaSessions.find(id);
+    if(!mediaSession || mediaSession->recorder) {
         owner->disconnect();
         return;
     }
 
-    MediaSession& mediaSession = *(it->second);
-    WebRTCPeer& localPeer = *mediaSession.localPeer;
+    WebRTCPeer& localPeer = *mediaSession->localPeer;
 
-    if(localPeer.sdp().empty())
+    const std::string& sdp = localPeer.sdp();
+    if(sdp.empty())
         owner->disconnect();
     else {
+        if(offerStructureStats)
+            offerStructureStats->update(mediaSession->uri, sdp);
+
         rtsp::Response response;
-        prepareOkResponse(requestInfo.requestPtr->cseq, session, &response);
+        prepareOkResponse(describeRequestCSeq, ToSessionId(id), &response);
 
         response.headerFields.emplace("Content-Type", "application/sdp");
 
-        response.body = localPeer.sdp();
+        response.body = sdp;
 
         owner->sendResponse(response);
 
-        mediaSession.createRequest.swap(requestInfo.requestPtr);
+        recordPhase(mediaSession, SessionTimings::Phase::Prepared);
     }
 }
 
 void ServerSession::Private::recorderPrepared(rtsp::CSeq announceRequestCSeq)
 {
     auto requestIt = announceRequests.find(announceRequestCSeq);
-    if(announceRequests.end() == requestIt ||
-       rtsp::Method::ANNOUNCE != requestIt->second.requestPtr->method)
-    {
+    if(announceRequests.end() == requestIt) {
         owner->disconnect();
         return;
     }
 
     AutoEraseRecordRequest autoEraseRequest(this, requestIt);
 
-    RequestInfo& requestInfo = requestIt->second;
-    const rtsp::SessionId& session = requestInfo.session;
+    const MediaSessionId id = requestIt->second;
 
-    auto it = mediaSessions.find(session);
-    if(mediaSessions.end() == it || !it->second->recorder) {
+    MediaSession* mediaSession = mediaSessions.find(id);
+    if(!mediaSession || !mediaSession->recorder) {
         owner->disconnect();
         return;
     }
 
-    MediaSession& mediaSession = *(it->second);
-    WebRTCPeer& recorder = *mediaSession.localPeer;
+    WebRTCPeer& recorder = *mediaSession->localPeer;
 
     if(recorder.sdp().empty())
         owner->disconnect();
     else {
         rtsp::Response response;
-        prepareOkResponse(requestInfo.requestPtr->cseq, session, &response);
+        prepareOkResponse(announceRequestCSeq, ToSessionId(id), &response);
 
         response.headerFields.emplace("Content-Type", "application/sdp");
 
@@ -195,201 +285,267 @@ void ServerSession::Private::recorderPrepared(rtsp::CSeq announceRequestCSeq)
 
         owner->sendResponse(response);
 
-        mediaSession.createRequest.swap(requestInfo.requestPtr);
+        recordPhase(mediaSession, SessionTimings::Phase::Prepared);
     }
 }
 
 void ServerSession::Private::iceCandidate(
-    const rtsp::SessionId& session,
+    MediaSessionId id,
     unsigned mlineIndex, const std::string& candidate)
 {
-    auto it = mediaSessions.find(session);
-    if(mediaSessions.end() == it) {
+    MediaSession* mediaSessionPtr = mediaSessions.find(id);
+    if(!mediaSessionPtr) {
         owner->disconnect();
         return;
     }
 
-    const MediaSession& mediaSession = *(it->second);
+    MediaSession& mediaSession = *mediaSessionPtr;
 
-    owner->requestSetup(
-        mediaSession.uri,
-        "application/x-ice-candidate",
-        session,
-        std::to_string(mlineIndex) + "/" + candidate + "\r\n");
-}
+    rtsp::SerializeIceCandidate(mlineIndex, candidate, &mediaSession.iceCandidates);
+    ++mediaSession.iceCandidatesCount;
 
-void ServerSession::Private::eos(const rtsp::SessionId& session)
-{
-    Log()->trace("Eos. Session: {}", session);
+    if(!iceCoalescingWindow ||
+        (maxCoalescedIceCandidates &&
+            mediaSession.iceCandidatesCount >= maxCoalescedIceCandidates))
+    {
+        flushIceCandidates(id, &mediaSession);
+        return;
+    }
 
-    owner->onEos();
-}
+    if(mediaSession.iceFlushSource)
+        return;
 
+    GMainContext* context = g_main_context_get_thread_default();
+    if(!g_main_context_is_owner(context ? context : g_main_context_default())) {
+        // GMainContext is not iterated by this thread (f.e. EventLoop::Native),
+        // so flush timeout would never fire
+        Log()->debug("No GLib loop to coalesce ICE candidates on. Sending right away...");
+        flushIceCandidates(id, &mediaSession);
+        return;
+    }
 
-ServerSession::ServerSession(
-    const std::function<std::unique_ptr<WebRTCPeer> (const std::string& uri)>& createPeer,
-    const std::function<void (const rtsp::Request*)>& sendRequest,
-    const std::function<void (const rtsp::Response*)>& sendResponse) noexcept :
-    rtsp::ServerSession(sendRequest, sendResponse),
-    _p(new Private(this, createPeer))
-{
+    struct FlushData
+    {
+        Private* owner;
+        MediaSessionId id;
+    };
+
+    mediaSession.iceFlushSource.reset(g_timeout_source_new(iceCoalescingWindow));
+    g_source_set_callback(
+        mediaSession.iceFlushSource.get(),
+        [] (gpointer userData) -> gboolean {
+            FlushData* data = static_cast<FlushData*>(userData);
+
+            if(MediaSession* mediaSession = data->owner->mediaSessions.find(data->id))
+                data->owner->flushIceCandidates(data->id, mediaSession);
+
+            return G_SOURCE_REMOVE;
+        },
+        new FlushData { this, id },
+        [] (gpointer userData) {
+            delete static_cast<FlushData*>(userData);
+        });
+    g_source_attach(mediaSession.iceFlushSource.get(), context);
 }
 
-ServerSession::ServerSession(
-    const std::function<std::unique_ptr<WebRTCPeer> (const std::string& uri)>& createPeer,
-    const std::function<std::unique_ptr<WebRTCPeer> (const std::string& uri)>& createRecordPeer,
-    const std::function<void (const rtsp::Request*)>& sendRequest,
-    const std::function<void (const rtsp::Response*)>& sendResponse) noexcept :
-    rtsp::ServerSession(sendRequest, sendResponse),
-    _p(new Private(this, createPeer, createRecordPeer))
+void ServerSession::Private::flushIceCandidates(
+    MediaSessionId id,
+    MediaSession* mediaSession)
 {
-}
+    if(mediaSession->iceFlushSource) {
+        g_source_destroy(mediaSession->iceFlushSource.get());
+        mediaSession->iceFlushSource.reset();
+    }
 
-ServerSession::~ServerSession()
-{
-}
+    if(mediaSession->iceCandidates.empty())
+        return;
 
-void ServerSession::setIceServers(const WebRTCPeer::IceServers& iceServers)
-{
-    _p->iceServers = iceServers;
+    std::string iceCandidates;
+    iceCandidates.swap(mediaSession->iceCandidates);
+    mediaSession->iceCandidatesCount = 0;
+
+    recordPhase(mediaSession, SessionTimings::Phase::FirstLocalIceCandidate);
+
+    owner->requestSetup(
+        mediaSession->uri,
+        "application/x-ice-candidate",
+        ToSessionId(id),
+        iceCandidates);
 }
 
-bool ServerSession::onOptionsRequest(
-    std::unique_ptr<rtsp::Request>& requestPtr) noexcept
+bool ServerSession::Private::describe(
+    std::unique_ptr<rtsp::Request>& requestPtr,
+    SessionTimings::Clock::time_point requestTime,
+    PeerAdmission::TicketPtr&& admissionTicket)
 {
-    rtsp::Response response;
-    prepareOkResponse(requestPtr->cseq, rtsp::SessionId(), &response);
-
-    response.headerFields.emplace(
-        "Public",
-        _p->recordEnabled() ?
-            "DESCRIBE, ANNOUNCE, SETUP, PLAY, RECORD, TEARDOWN" :
-            "DESCRIBE, SETUP, PLAY, TEARDOWN");
+    if(peerPool) {
+        std::unique_ptr<WebRTCPeer> peerPtr = peerPool->takePeer(requestPtr->uri, iceServers);
+        if(peerPtr)
+            return describe(requestPtr, requestTime, std::move(admissionTicket), std::move(peerPtr));
+    }
 
-    sendResponse(response);
+    std::unique_ptr<WebRTCPeer> peerPtr;
+    if(peerWorkers) {
+        peerPtr = peerWorkers->createPeer(createPeer, requestPtr->uri);
+        if(!peerPtr) {
+            Log()->debug("Peer workers are busy. Refusing DESCRIBE...");
+            sendServiceUnavailable(requestPtr->cseq);
+            return true;
+        }
+    } else
+        peerPtr = createPeer(requestPtr->uri);
 
-    return true;
+    return describe(requestPtr, requestTime, std::move(admissionTicket), std::move(peerPtr));
 }
 
-bool ServerSession::onDescribeRequest(
-    std::unique_ptr<rtsp::Request>& requestPtr) noexcept
+bool ServerSession::Private::describe(
+    std::unique_ptr<rtsp::Request>& requestPtr,
+    SessionTimings::Clock::time_point requestTime,
+    PeerAdmission::TicketPtr&& admissionTicket,
+    std::unique_ptr<WebRTCPeer>&& peerPtr)
 {
-    std::unique_ptr<WebRTCPeer> peerPtr = _p->createPeer(requestPtr->uri);
     if(!peerPtr)
         return false;
 
-    const rtsp::SessionId session = _p->nextSession();
-    auto requestPair =
-        _p->describeRequests.emplace(
-            requestPtr->cseq,
-            RequestInfo {
-                .requestPtr = nullptr,
-                .session = session,
-            });
-    if(!requestPair.second)
+    const rtsp::Request& request = *requestPtr;
+    if(describeRequests.count(request.cseq))
         return false;
 
-    RequestInfo& requestInfo = requestPair.first->second;
-    requestInfo.requestPtr = std::move(requestPtr);
-    rtsp::Request& request = *requestInfo.requestPtr;
+    auto emplacePair = mediaSessions.emplace();
+    const MediaSessionId id = emplacePair.first;
+    MediaSession& mediaSession = *emplacePair.second;
 
-    Private::AutoEraseRequest autoEraseRequest(_p.get(), requestPair.first);
+    auto requestIt = describeRequests.emplace(request.cseq, id).first;
 
-    auto emplacePair =
-        _p->mediaSessions.emplace(
-            session,
-            std::make_unique<MediaSession>());
-    if(!emplacePair.second)
-        return false;
+    AutoEraseRequest autoEraseRequest(this, requestIt);
 
-    MediaSession& mediaSession = *(emplacePair.first->second);
     mediaSession.recorder = false;
     mediaSession.uri = request.uri;
+    mediaSession.admissionTicket = std::move(admissionTicket);
     mediaSession.localPeer = std::move(peerPtr);
+    mediaSession.requestTime = requestTime;
+
+    recordPhase(&mediaSession, SessionTimings::Phase::PeerCreated);
 
     mediaSession.localPeer->prepare(
-        _p->iceServers,
+        iceServers,
         std::bind(
             &ServerSession::Private::streamerPrepared,
-            _p.get(),
+            this,
             request.cseq),
         std::bind(
             &ServerSession::Private::iceCandidate,
-            _p.get(),
-            session,
+            this,
+            id,
             std::placeholders::_1,
             std::placeholders::_2),
         std::bind(
             &ServerSession::Private::eos,
-            _p.get(),
-            session));
+            this,
+            id));
 
     autoEraseRequest.discard();
 
     return true;
 }
 
-bool ServerSession::onAnnounceRequest(
-    std::unique_ptr<rtsp::Request>& requestPtr) noexcept
+bool ServerSession::Private::queueDescribe(
+    std::unique_ptr<rtsp::Request>& requestPtr,
+    SessionTimings::Clock::time_point requestTime)
 {
-    if(!_p->recordEnabled())
+    const rtsp::CSeq cseq = requestPtr->cseq;
+    if(queuedDescribeRequests.count(cseq) || describeRequests.count(cseq))
         return false;
 
-    std::unique_ptr<WebRTCPeer> peerPtr = _p->createRecordPeer(requestPtr->uri);
-    if(!peerPtr)
-        return false;
+    PeerAdmission::WaiterPtr waiter =
+        peerAdmission->enqueue(
+            requestPtr->uri,
+            [this, cseq] (PeerAdmission::TicketPtr&& admissionTicket) {
+                describeAdmitted(cseq, std::move(admissionTicket));
+            });
+    if(!waiter) {
+        Log()->debug("No peer capacity. Refusing DESCRIBE...");
+        sendServiceUnavailable(cseq);
+        return true;
+    }
+
+    Log()->debug("No peer capacity. Queueing DESCRIBE...");
+
+    queuedDescribeRequests.emplace(
+        cseq,
+        QueuedRequest { std::move(requestPtr), requestTime, std::move(waiter) });
+
+    return true;
+}
+
+void ServerSession::Private::describeAdmitted(
+    rtsp::CSeq describeRequestCSeq,
+    PeerAdmission::TicketPtr&& admissionTicket)
+{
+    auto it = queuedDescribeRequests.find(describeRequestCSeq);
+    if(queuedDescribeRequests.end() == it)
+        return;
+
+    std::unique_ptr<rtsp::Request> requestPtr = std::move(it->second.requestPtr);
+    const SessionTimings::Clock::time_point requestTime = it->second.requestTime;
+    queuedDescribeRequests.erase(it);
 
-    const std::string contentType = RequestContentType(*requestPtr);
-    if(contentType != "application/sdp")
+    if(!admissionTicket) {
+        sendServiceUnavailable(describeRequestCSeq);
+        return;
+    }
+
+    if(!describe(requestPtr, requestTime, std::move(admissionTicket)))
+        owner->disconnect();
+}
+
+bool ServerSession::Private::announce(
+    std::unique_ptr<rtsp::Request>& requestPtr,
+    SessionTimings::Clock::time_point requestTime,
+    PeerAdmission::TicketPtr&& admissionTicket,
+    std::unique_ptr<WebRTCPeer>&& peerPtr)
+{
+    if(!peerPtr)
         return false;
 
-    const rtsp::SessionId session = _p->nextSession();
-    auto requestPair =
-        _p->announceRequests.emplace(
-            requestPtr->cseq,
-            RequestInfo {
-                .requestPtr = nullptr,
-                .session = session,
-            });
-    if(!requestPair.second)
+    const rtsp::Request& request = *requestPtr;
+    if(announceRequests.count(request.cseq))
         return false;
 
-    RequestInfo& requestInfo = requestPair.first->second;
-    requestInfo.requestPtr = std::move(requestPtr);
-    rtsp::Request& request = *requestInfo.requestPtr;
+    auto emplacePair = mediaSessions.emplace();
+    const MediaSessionId id = emplacePair.first;
+    MediaSession& mediaSession = *emplacePair.second;
 
-    Private::AutoEraseRecordRequest autoEraseRequest(_p.get(), requestPair.first);
+    auto requestIt = announceRequests.emplace(request.cseq, id).first;
 
-    auto emplacePair =
-        _p->mediaSessions.emplace(
-            session,
-            std::make_unique<MediaSession>());
-    if(!emplacePair.second)
-        return false;
+    AutoEraseRecordRequest autoEraseRequest(this, requestIt);
 
-    MediaSession& mediaSession = *(emplacePair.first->second);
     mediaSession.recorder = true;
     mediaSession.uri = request.uri;
+    mediaSession.admissionTicket = std::move(admissionTicket);
     mediaSession.localPeer = std::move(peerPtr);
+    mediaSession.requestTime = requestTime;
+
+    recordPhase(&mediaSession, SessionTimings::Phase::PeerCreated);
 
     mediaSession.localPeer->prepare(
-        _p->iceServers,
+        iceServers,
         std::bind(
             &ServerSession::Private::recorderPrepared,
-            _p.get(),
+            this,
             request.cseq),
         std::bind(
             &ServerSession::Private::iceCandidate,
-            _p.get(),
-            session,
+            this,
+            id,
             std::placeholders::_1,
             std::placeholders::_2),
         std::bind(
             &ServerSession::Private::eos,
-            _p.get(),
-            session));
+            this,
+            id));
 
-    const std::string& sdp = requestInfo.requestPtr->body;
+    const std::string& sdp = request.body;
     if(sdp.empty())
         return false;
 
@@ -400,21 +556,198 @@ bool ServerSession::onAnnounceRequest(
     return true;
 }
 
-bool ServerSession::onSetupRequest(
+void ServerSession::Private::recordPhase(
+    MediaSession* mediaSession,
+    SessionTimings::Phase phase)
+{
+    if(!sessionTimings)
+        return;
+
+    const unsigned phaseBit = 1u << static_cast<unsigned>(phase);
+    if(mediaSession->timedPhases & phaseBit)
+        return;
+
+    mediaSession->timedPhases |= phaseBit;
+
+    sessionTimings->record(
+        mediaSession->uri,
+        phase,
+        SessionTimings::Clock::now() - mediaSession->requestTime);
+}
+
+void ServerSession::Private::sendServiceUnavailable(rtsp::CSeq cseq)
+{
+    rtsp::Response response;
+    prepareResponse(
+        rtsp::SERVICE_UNAVAILABLE,
+        "Service Unavailable",
+        cseq,
+        rtsp::SessionId(),
+        &response);
+
+    const unsigned retryAfter = peerAdmission ? peerAdmission->config().retryAfter : 0;
+    if(retryAfter)
+        response.headerFields.emplace("Retry-After", std::to_string(retryAfter));
+
+    owner->sendResponse(response);
+}
+
+void ServerSession::Private::eos(MediaSessionId id)
+{
+    Log()->trace("Eos. Session: {}", ToSessionId(id));
+
+    owner->onEos();
+}
+
+
+ServerSession::ServerSession(
+    const std::function<std::unique_ptr<WebRTCPeer> (const std::string& uri)>& createPeer,
+    const std::function<void (const rtsp::Request*)>& sendRequest,
+    const std::function<void (const rtsp::Response*)>& sendResponse) noexcept :
+    rtsp::ServerSession(sendRequest, sendResponse),
+    _p(new Private(this, createPeer))
+{
+}
+
+ServerSession::ServerSession(
+    const std::function<std::unique_ptr<WebRTCPeer> (const std::string& uri)>& createPeer,
+    const std::function<std::unique_ptr<WebRTCPeer> (const std::string& uri)>& createRecordPeer,
+    const std::function<void (const rtsp::Request*)>& sendRequest,
+    const std::function<void (const rtsp::Response*)>& sendResponse) noexcept :
+    rtsp::ServerSession(sendRequest, sendResponse),
+    _p(new Private(this, createPeer, createRecordPeer))
+{
+}
+
+ServerSession::~ServerSession()
+{
+}
+
+void ServerSession::setIceServers(const WebRTCPeer::IceServers& iceServers)
+{
+    _p->iceServers = iceServers;
+}
+
+void ServerSession::setIceCoalescing(unsigned window, unsigned maxCandidates)
+{
+    _p->iceCoalescingWindow = window;
+    _p->maxCoalescedIceCandidates = maxCandidates;
+}
+
+void ServerSession::setPeerAdmission(const std::shared_ptr<PeerAdmission>& peerAdmission)
+{
+    _p->peerAdmission = peerAdmission;
+}
+
+void ServerSession::setOfferStructureStats(const std::shared_ptr<OfferStructureStats>& offerStructureStats)
+{
+    _p->offerStructureStats = offerStructureStats;
+}
+
+void ServerSession::setPeerWorkers(const std::shared_ptr<PeerWorkers>& peerWorkers)
+{
+    _p->peerWorkers = peerWorkers;
+}
+
+void ServerSession::setPeerPool(const std::shared_ptr<PeerPool>& peerPool)
+{
+    _p->peerPool = peerPool;
+}
+
+void ServerSession::setSessionTimings(const std::shared_ptr<SessionTimings>& sessionTimings)
+{
+    _p->sessionTimings = sessionTimings;
+}
+
+unsigned ServerSession::mediaSessionsCount() const noexcept
+{
+    return static_cast<unsigned>(_p->mediaSessions.size());
+}
+
+bool ServerSession::onOptionsRequest(
     std::unique_ptr<rtsp::Request>& requestPtr) noexcept
 {
-    const rtsp::SessionId session = RequestSession(*requestPtr);
+    rtsp::Response response;
+    prepareOkResponse(requestPtr->cseq, rtsp::SessionId(), &response);
+
+    response.headerFields.emplace(
+        "Public",
+        _p->recordEnabled() ?
+            "DESCRIBE, ANNOUNCE, SETUP, PLAY, RECORD, TEARDOWN" :
+            "DESCRIBE, SETUP, PLAY, TEARDOWN");
+
+    sendResponse(response);
 
-    auto it = _p->mediaSessions.find(session);
-    if(it == _p->mediaSessions.end())
+    return true;
+}
+
+bool ServerSession::onDescribeRequest(
+    std::unique_ptr<rtsp::Request>& requestPtr) noexcept
+{
+    const SessionTimings::Clock::time_point requestTime = SessionTimings::Clock::now();
+
+    PeerAdmission::TicketPtr admissionTicket;
+    if(_p->peerAdmission) {
+        admissionTicket = _p->peerAdmission->admit(requestPtr->uri);
+        if(!admissionTicket)
+            return _p->queueDescribe(requestPtr, requestTime);
+    }
+
+    return _p->describe(requestPtr, requestTime, std::move(admissionTicket));
+}
+
+bool ServerSession::onAnnounceRequest(
+    std::unique_ptr<rtsp::Request>& requestPtr) noexcept
+{
+    if(!_p->recordEnabled())
         return false;
 
-    WebRTCPeer& localPeer = *it->second->localPeer;
+    const SessionTimings::Clock::time_point requestTime = SessionTimings::Clock::now();
+
+    PeerAdmission::TicketPtr admissionTicket;
+    if(_p->peerAdmission) {
+        // recorders are not queued since client holds own media pipeline meanwhile
+        admissionTicket = _p->peerAdmission->admit(requestPtr->uri);
+        if(!admissionTicket) {
+            Log()->debug("No peer capacity. Refusing ANNOUNCE...");
+            _p->sendServiceUnavailable(requestPtr->cseq);
+            return true;
+        }
+    }
+
+    if(RequestContentType(*requestPtr) != "application/sdp")
+        return false;
+
+    std::unique_ptr<WebRTCPeer> peerPtr;
+    if(_p->peerWorkers) {
+        peerPtr = _p->peerWorkers->createPeer(_p->createRecordPeer, requestPtr->uri);
+        if(!peerPtr) {
+            Log()->debug("Peer workers are busy. Refusing ANNOUNCE...");
+            _p->sendServiceUnavailable(requestPtr->cseq);
+            return true;
+        }
+    } else
+        peerPtr = _p->createRecordPeer(requestPtr->uri);
+
+    return _p->announce(requestPtr, requestTime, std::move(admissionTicket), std::move(peerPtr));
+}
+
+bool ServerSession::onSetupRequest(
+    std::unique_ptr<rtsp::Request>& requestPtr) noexcept
+{
+    MediaSessionId id;
+    MediaSession* mediaSession = _p->findMediaSession(*requestPtr, &id);
+    if(!mediaSession)
+        return false;
+
+    WebRTCPeer& localPeer = *mediaSession->localPeer;
 
     if(RequestContentType(*requestPtr) == "application/sdp") {
+        _p->recordPhase(mediaSession, SessionTimings::Phase::Answer);
+
         localPeer.setRemoteSdp(requestPtr->body);
 
-        sendOkResponse(requestPtr->cseq, session);
+        sendOkResponse(requestPtr->cseq, ToSessionId(id));
 
         return true;
     }
@@ -424,39 +757,25 @@ bool ServerSession::onSetupRequest(
 
     const std::string& ice = requestPtr->body;
 
-    std::string::size_type pos = 0;
-    while(pos < ice.size()) {
-        const std::string::size_type lineEndPos = ice.find("\r\n", pos);
-        if(lineEndPos == std::string::npos)
-            return false;
+    if(!ice.empty())
+        _p->recordPhase(mediaSession, SessionTimings::Phase::FirstRemoteIceCandidate);
 
-        const std::string line = ice.substr(pos, lineEndPos - pos);
-
-        const std::string::size_type delimiterPos = line.find("/");
-        if(delimiterPos == std::string::npos || 0 == delimiterPos)
+    size_t pos = 0;
+    unsigned mlineIndex;
+    rtsp::Token candidateToken;
+    std::string candidate;
+    while(pos < ice.size()) {
+        if(!rtsp::ParseIceCandidate(ice, &pos, &mlineIndex, &candidateToken))
             return false;
 
-        try{
-            const int idx = std::stoi(line.substr(0, delimiterPos));
-            if(idx < 0)
-                return false;
+        candidate.assign(candidateToken.token, candidateToken.size);
 
-            const std::string candidate =
-                line.substr(delimiterPos + 1);
+        Log()->trace("Adding ice candidate \"{}\"", candidate);
 
-            if(candidate.empty())
-                return false;
-
-            Log()->trace("Adding ice candidate \"{}\"", candidate);
-
-            localPeer.addIceCandidate(idx, candidate);
-        } catch(...) {
-            return false;
-        }
-        pos = lineEndPos + 2;
+        localPeer.addIceCandidate(mlineIndex, candidate);
     }
 
-    sendOkResponse(requestPtr->cseq, session);
+    sendOkResponse(requestPtr->cseq, ToSessionId(id));
 
     return true;
 
@@ -465,23 +784,22 @@ bool ServerSession::onSetupRequest(
 bool ServerSession::onPlayRequest(
     std::unique_ptr<rtsp::Request>& requestPtr) noexcept
 {
-    const rtsp::SessionId session = RequestSession(*requestPtr);
-    if(session.empty())
+    MediaSessionId id;
+    MediaSession* mediaSessionPtr = _p->findMediaSession(*requestPtr, &id);
+    if(!mediaSessionPtr)
         return false;
 
-    auto it = _p->mediaSessions.find(session);
-    if(it == _p->mediaSessions.end())
-        return false;
-
-    MediaSession& mediaSession = *it->second;
+    MediaSession& mediaSession = *mediaSessionPtr;
     if(mediaSession.recorder)
         return false;
 
     WebRTCPeer& localPeer = *(mediaSession.localPeer);
 
+    _p->recordPhase(&mediaSession, SessionTimings::Phase::Play);
+
     localPeer.play();
 
-    sendOkResponse(requestPtr->cseq, session);
+    sendOkResponse(requestPtr->cseq, ToSessionId(id));
 
     return true;
 }
@@ -492,23 +810,22 @@ bool ServerSession::onRecordRequest(
     if(!_p->recordEnabled())
         return false;
 
-    const rtsp::SessionId session = RequestSession(*requestPtr);
-    if(session.empty())
+    MediaSessionId id;
+    MediaSession* mediaSessionPtr = _p->findMediaSession(*requestPtr, &id);
+    if(!mediaSessionPtr)
         return false;
 
-    auto it = _p->mediaSessions.find(session);
-    if(it == _p->mediaSessions.end())
-        return false;
-
-    MediaSession& mediaSession = *it->second;
+    MediaSession& mediaSession = *mediaSessionPtr;
     if(!mediaSession.recorder)
         return false;
 
     WebRTCPeer& localPeer = *(mediaSession.localPeer);
 
+    _p->recordPhase(&mediaSession, SessionTimings::Phase::Play);
+
     localPeer.play();
 
-    sendOkResponse(requestPtr->cseq, session);
+    sendOkResponse(requestPtr->cseq, ToSessionId(id));
 
     return true;
 }
@@ -516,19 +833,18 @@ bool ServerSession::onRecordRequest(
 bool ServerSession::onTeardownRequest(
     std::unique_ptr<rtsp::Request>& requestPtr) noexcept
 {
-    const rtsp::SessionId session = RequestSession(*requestPtr);
-
-    auto it = _p->mediaSessions.find(session);
-    if(it == _p->mediaSessions.end())
+    MediaSessionId id;
+    MediaSession* mediaSession = _p->findMediaSession(*requestPtr, &id);
+    if(!mediaSession)
         return false;
 
-    WebRTCPeer& localPeer = *(it->second->localPeer);
+    WebRTCPeer& localPeer = *(mediaSession->localPeer);
 
     localPeer.stop();
 
-    sendOkResponse(requestPtr->cseq, session);
+    sendOkResponse(requestPtr->cseq, ToSessionId(id));
 
-    _p->mediaSessions.erase(it);
+    _p->mediaSessions.erase(id);
 
     return true;
 }
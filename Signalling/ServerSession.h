@@ -3,6 +3,12 @@
 #include "RtStreaming/WebRTCPeer.h"
 #include "RtspSession/ServerSession.h"
 
+#include "PeerAdmission.h"
+#include "OfferStructureStats.h"
+#include "PeerWorkers.h"
+#include "PeerPool.h"
+#include "SessionTimings.h"
+
 
 class ServerSession: public rtsp::ServerSession
 {
@@ -20,6 +26,39 @@ public:
 
     void setIceServers(const WebRTCPeer::IceServers&);
 
+    // Local ICE candidates gathered during window (milliseconds)
+    // are sent as single multi-line SETUP request,
+    // maxCandidates reached flushes batch earlier.
+    // 0 window - every candidate is sent right away.
+    // Requires GLib loop, with EventLoop::Native candidates are not coalesced.
+    void setIceCoalescing(unsigned window, unsigned maxCandidates = 0);
+
+    // DESCRIBE and ANNOUNCE are admitted only within PeerAdmission limits,
+    // DESCRIBE exceeding limits waits in PeerAdmission queue,
+    // the rest is answered with 503 Service Unavailable.
+    // Can be shared by all sessions of server.
+    void setPeerAdmission(const std::shared_ptr<PeerAdmission>&);
+
+    // DESCRIBE offers are accounted in OfferStructureStats.
+    // Can be shared by all sessions of server.
+    void setOfferStructureStats(const std::shared_ptr<OfferStructureStats>&);
+
+    // peers are constructed and prepared on PeerWorkers threads,
+    // so createPeer/createRecordPeer should be thread safe.
+    // Can be shared by all sessions of server.
+    void setPeerWorkers(const std::shared_ptr<PeerWorkers>&);
+
+    // DESCRIBE takes already prepared peer from PeerPool if there is one
+    // for the same URI and ICE servers, falls back to createPeer otherwise.
+    // Can be shared by all sessions of server running on the same loop.
+    void setPeerPool(const std::shared_ptr<PeerPool>&);
+
+    // media session startup phases are recorded to SessionTimings.
+    // Can be shared by all sessions of server.
+    void setSessionTimings(const std::shared_ptr<SessionTimings>&);
+
+    unsigned mediaSessionsCount() const noexcept override;
+
 private:
     bool onOptionsRequest(std::unique_ptr<rtsp::Request>&) noexcept override;
     bool onDescribeRequest(std::unique_ptr<rtsp::Request>&) noexcept override;
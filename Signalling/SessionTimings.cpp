@@ -0,0 +1,99 @@
+#include "SessionTimings.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+
+namespace {
+
+void Add(SessionTimings::Histogram* histogram, unsigned long long duration)
+{
+    unsigned bucket = 0;
+    while(bucket < SessionTimings::HISTOGRAM_BUCKETS - 1 && (duration >> bucket) > 0)
+        ++bucket;
+
+    ++histogram->buckets[bucket];
+    ++histogram->count;
+    histogram->total += duration;
+    histogram->max = std::max(histogram->max, duration);
+}
+
+}
+
+struct SessionTimings::Private
+{
+    Private(unsigned maxUris) :
+        maxUris(maxUris) {}
+
+    const unsigned maxUris;
+
+    Histograms global {};
+    std::unordered_map<std::string, Histograms> uris;
+};
+
+const char* SessionTimings::PhaseName(Phase phase) noexcept
+{
+    switch(phase) {
+    case Phase::PeerCreated:
+        return "PeerCreated";
+    case Phase::Prepared:
+        return "Prepared";
+    case Phase::FirstLocalIceCandidate:
+        return "FirstLocalIceCandidate";
+    case Phase::FirstRemoteIceCandidate:
+        return "FirstRemoteIceCandidate";
+    case Phase::Answer:
+        return "Answer";
+    case Phase::Play:
+        return "Play";
+    }
+
+    return nullptr;
+}
+
+SessionTimings::SessionTimings(unsigned maxUris) noexcept :
+    _p(std::make_unique<Private>(maxUris))
+{
+}
+
+SessionTimings::~SessionTimings()
+{
+}
+
+void SessionTimings::record(
+    const std::string& uri,
+    Phase phase,
+    Clock::duration sinceRequest) noexcept
+{
+    const unsigned long long duration =
+        std::chrono::duration_cast<std::chrono::milliseconds>(sinceRequest).count();
+    const unsigned index = static_cast<unsigned>(phase);
+
+    Add(&_p->global.phases[index], duration);
+
+    auto it = _p->uris.find(uri);
+    if(it == _p->uris.end()) {
+        if(_p->uris.size() >= _p->maxUris)
+            return;
+
+        it = _p->uris.emplace(uri, Histograms()).first;
+    }
+
+    Add(&it->second.phases[index], duration);
+}
+
+SessionTimings::Histograms SessionTimings::global() const noexcept
+{
+    return _p->global;
+}
+
+bool SessionTimings::uri(const std::string& uri, Histograms* out) const noexcept
+{
+    auto it = _p->uris.find(uri);
+    if(it == _p->uris.end())
+        return false;
+
+    *out = it->second;
+
+    return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <chrono>
+
+
+// Histograms of media session startup phases,
+// every phase is measured from DESCRIBE/ANNOUNCE receiving.
+// Aggregated globally and per URI.
+class SessionTimings
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum class Phase {
+        PeerCreated, // createPeer returned
+        Prepared, // SDP sent
+        FirstLocalIceCandidate, // sent
+        FirstRemoteIceCandidate, // received
+        Answer, // SETUP with SDP
+        Play, // PLAY or RECORD
+    };
+    enum {
+        PHASES_COUNT = static_cast<unsigned>(Phase::Play) + 1,
+        // bucket N counts durations less than 2^N milliseconds,
+        // the last one - the rest
+        HISTOGRAM_BUCKETS = 16,
+    };
+
+    struct Histogram
+    {
+        unsigned long long buckets[HISTOGRAM_BUCKETS];
+        unsigned long long count;
+        unsigned long long total; // milliseconds
+        unsigned long long max; // milliseconds
+    };
+
+    struct Histograms
+    {
+        Histogram phases[PHASES_COUNT];
+    };
+
+    static const char* PhaseName(Phase) noexcept;
+
+    // maxUris - URIs aggregated separately,
+    // the rest is accounted in global histograms only
+    explicit SessionTimings(unsigned maxUris = 256) noexcept;
+    ~SessionTimings();
+
+    void record(
+        const std::string& uri,
+        Phase,
+        Clock::duration sinceRequest) noexcept;
+
+    Histograms global() const noexcept;
+    // false if there is nothing recorded for URI
+    bool uri(const std::string&, Histograms*) const noexcept;
+
+private:
+    struct Private;
+    std::unique_ptr<Private> _p;
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace signalling {
+
+// Dense storage with O(1) insert/lookup/erase by numeric id.
+// Values live inline in stable slots (never moved), freed slots are reused
+// with bumped generation so stale ids don't resolve to a new value.
+template<typename T>
+class SlotMap
+{
+public:
+    // low 32 bits - slot index, next 21 bits - slot generation (never 0),
+    // so id fits 53 bits and is exactly representable as JavaScript number
+    typedef uint64_t Id;
+
+    SlotMap() = default;
+    SlotMap(const SlotMap&) = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+    ~SlotMap()
+        { clear(); }
+
+    std::pair<Id, T*> emplace()
+    {
+        uint32_t index;
+        if(_freeSlots.empty()) {
+            index = static_cast<uint32_t>(_slots.size());
+            _slots.emplace_back();
+        } else {
+            index = _freeSlots.back();
+            _freeSlots.pop_back();
+        }
+
+        Slot& slot = _slots[index];
+        new (&slot.storage) T();
+        slot.used = true;
+        ++_size;
+
+        return { MakeId(index, slot.generation), slot.value() };
+    }
+
+    T* find(Id id) noexcept
+    {
+        Slot* slot = lookup(id);
+        return slot ? slot->value() : nullptr;
+    }
+
+    bool erase(Id id)
+    {
+        Slot* slot = lookup(id);
+        if(!slot)
+            return false;
+
+        // invalidate id first, so it's not resolvable from value's destructor
+        slot->used = false;
+        slot->generation = (slot->generation + 1) & GENERATION_MASK;
+        if(0 == slot->generation)
+            slot->generation = 1;
+        --_size;
+
+        slot->value()->~T();
+
+        _freeSlots.push_back(IdIndex(id));
+
+        return true;
+    }
+
+    void clear()
+    {
+        for(uint32_t index = 0; index < _slots.size(); ++index) {
+            Slot& slot = _slots[index];
+            if(slot.used)
+                erase(MakeId(index, slot.generation));
+        }
+    }
+
+    size_t size() const noexcept
+        { return _size; }
+
+private:
+    enum: uint32_t {
+        GENERATION_BITS = 21,
+        GENERATION_MASK = (1u << GENERATION_BITS) - 1,
+    };
+
+    struct Slot
+    {
+        uint32_t generation = 1;
+        bool used = false;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T* value() noexcept
+            { return reinterpret_cast<T*>(&storage); }
+    };
+
+    static Id MakeId(uint32_t index, uint32_t generation) noexcept
+        { return static_cast<Id>(generation) << 32 | index; }
+    static uint32_t IdIndex(Id id) noexcept
+        { return static_cast<uint32_t>(id); }
+    static uint32_t IdGeneration(Id id) noexcept
+        { return id >> 32 > GENERATION_MASK ? 0 : static_cast<uint32_t>(id >> 32); }
+
+    Slot* lookup(Id id) noexcept
+    {
+        const uint32_t index = IdIndex(id);
+        if(index >= _slots.size())
+            return nullptr;
+
+        Slot& slot = _slots[index];
+        if(!slot.used || slot.generation != IdGeneration(id))
+            return nullptr;
+
+        return &slot;
+    }
+
+private:
+    std::deque<Slot> _slots;
+    std::vector<uint32_t> _freeSlots;
+    size_t _size = 0;
+};
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+
+namespace signalling {
+
+class TokenBucket
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // rate == 0 means unlimited
+    TokenBucket(double rate, double burst) noexcept :
+        _rate(rate), _burst(std::max(burst, 1.)), _tokens(_burst), _lastRefill(Clock::now()) {}
+
+    bool consume(Clock::time_point now = Clock::now()) noexcept
+    {
+        if(_rate <= 0)
+            return true;
+
+        const std::chrono::duration<double> elapsed = now - _lastRefill;
+        _tokens = std::min(_burst, _tokens + elapsed.count() * _rate);
+        _lastRefill = now;
+
+        if(_tokens < 1)
+            return false;
+
+        _tokens -= 1;
+
+        return true;
+    }
+
+private:
+    const double _rate;
+    const double _burst;
+    double _tokens;
+    Clock::time_point _lastRefill;
+};
+
+}
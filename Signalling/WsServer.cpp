@@ -1,15 +1,26 @@
 #include "WsServer.h"
 
 #include <deque>
+#include <unordered_map>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 
 #include <CxxPtr/libwebsocketsPtr.h>
+#include <CxxPtr/GlibPtr.h>
 
 #include "Helpers/MessageBuffer.h"
 
 #include "RtspParser/RtspParser.h"
 #include "RtspParser/RtspSerialize.h"
-
+#include "RtspSession/MessagePriority.h"
+#include "Common/DeflateExtension.h"
+#include "Common/FlightRecorder.h"
+#include "Common/RttEstimator.h"
+#include "Common/TlsSessionResumption.h"
+
+#include "MessageBufferPool.h"
+#include "TokenBucket.h"
 #include "Log.h"
 
 
@@ -20,8 +31,17 @@ namespace {
 enum {
     RX_BUFFER_SIZE = 512,
     PING_INTERVAL = 30,
+    DRAIN_CHECK_INTERVAL = 1, // seconds
+    LOOP_LAG_SAMPLE_INTERVAL = 100, // milliseconds
+    LOOP_LAG_SMOOTHING_SHIFT = 3, // i.e. 1/8 of new sample
+    // with OverflowPolicy::PauseReceiving connection is closed
+    // if queue keeps growing up to that multiple of limits
+    PAUSED_OVERFLOW_SCALE = 2,
 };
 
+// CSeq range not used by sessions themselves
+const rtsp::CSeq BROADCAST_CSEQ_BASE = 0x80000000u;
+
 enum {
     HTTP_PROTOCOL_ID,
     PROTOCOL_ID,
@@ -29,12 +49,59 @@ enum {
     SECURE_PROTOCOL_ID,
 };
 
+enum class MessageKind {
+    Other,
+    IceCandidate,
+    // makes queued ICE candidates of the same session useless
+    // (TEARDOWN or new SDP)
+    IceReset,
+};
+
+struct OutgoingMessage
+{
+    MessageBufferPool::BufferPtr buffer;
+    rtsp::SessionId session;
+    MessageKind kind;
+    // order of messages over both priority queues
+    unsigned long long sequence;
+};
+
 struct SessionData
 {
+    explicit SessionData(const Config& config) :
+        flightRecorder(config.flightRecorderSize, config.flightRecorderPayloadSize),
+        messagesBucket(config.messagesRate, config.messagesBurst),
+        peerCreationsBucket(config.peerCreationsRate, config.peerCreationsBurst) {}
+
     bool terminateSession = false;
+    bool receivePaused = false; // outbound queue overflow
+    bool receiveThrottled = false; // processing budget is exhausted
+    unsigned iterationMessages = 0;
+    std::chrono::microseconds iterationHandlingTime { 0 };
     MessageBuffer incomingMessage;
-    std::deque<MessageBuffer> sendMessages;
+    std::deque<OutgoingMessage> prioritySendMessages;
+    std::deque<OutgoingMessage> sendMessages;
+    size_t sendBytes = 0;
+    unsigned long long nextMessageSequence = 0;
+    // last known rtspSession->mediaSessionsCount()
+    unsigned mediaSessions = 0;
     std::unique_ptr<rtsp::Session> rtspSession;
+    FlightRecorder flightRecorder;
+    std::string peerIp;
+    TokenBucket messagesBucket;
+    TokenBucket peerCreationsBucket;
+    RttEstimator rtt;
+    bool pingPending = false;
+    RttEstimator::Clock::time_point nextPingTime;
+    // of scheduled timer, to merge timer users
+    std::chrono::steady_clock::time_point timerDeadline;
+
+    bool hasMessagesToSend() const
+        { return !prioritySendMessages.empty() || !sendMessages.empty(); }
+    size_t messagesToSendCount() const
+        { return prioritySendMessages.size() + sendMessages.size(); }
+    std::deque<OutgoingMessage>& nextMessages()
+        { return prioritySendMessages.empty() ? sendMessages : prioritySendMessages; }
 };
 
 // Should contain only POD types,
@@ -43,34 +110,155 @@ struct SessionContextData
 {
     lws* wsi;
     SessionData* data;
+    bool deflate;
 };
 
 const auto Log = WsServerLog;
 
+std::string PeerIp(lws* wsi)
+{
+    char peerIp[64] = {};
+    lws_get_peer_simple(wsi, peerIp, sizeof(peerIp));
+
+    return peerIp;
+}
+
+bool IsPeerCreatingRequest(const MessageBuffer& message)
+{
+    static const char describe[] = "DESCRIBE ";
+    static const char announce[] = "ANNOUNCE ";
+
+    return
+        (message.size() >= sizeof(describe) - 1 &&
+            0 == memcmp(message.data(), describe, sizeof(describe) - 1)) ||
+        (message.size() >= sizeof(announce) - 1 &&
+            0 == memcmp(message.data(), announce, sizeof(announce) - 1));
+}
+
+MessageKind RequestKind(const rtsp::Request& request)
+{
+    if(request.method == rtsp::Method::TEARDOWN)
+        return MessageKind::IceReset;
+
+    const std::string contentType = rtsp::RequestContentType(request);
+    if(contentType == "application/x-ice-candidate")
+        return MessageKind::IceCandidate;
+    if(contentType == "application/sdp")
+        return MessageKind::IceReset;
+
+    return MessageKind::Other;
+}
+
+MessageKind ResponseKind(const rtsp::Response& response)
+{
+    return
+        rtsp::ResponseContentType(response) == "application/sdp" ?
+            MessageKind::IceReset :
+            MessageKind::Other;
+}
+
 }
 
 
 struct WsServer::Private
 {
+#if LWS_LIBRARY_VERSION_NUMBER >= 4000000
+    struct LoopLagTimer
+    {
+        lws_sorted_usec_list_t sul; // should be the first
+        Private* owner;
+    };
+#endif
+
     Private(WsServer*, const Config&, GMainLoop*, const WsServer::CreateSession&);
+    ~Private();
 
     bool init(lws_context* context);
     int httpCallback(lws*, lws_callback_reasons, void* user, void* in, size_t len);
     int wsCallback(lws*, lws_callback_reasons, void* user, void* in, size_t len);
+    bool isUnixSocketConnection(lws*) const;
+    bool isAdmissible(lws*, const std::string& peerIp) const;
+    bool checkRateLimits(SessionContextData*, const MessageBuffer&);
     bool onMessage(SessionContextData*, const MessageBuffer&);
-
-    void send(SessionContextData*, MessageBuffer*);
+    void chargeBudget(SessionContextData*, std::chrono::microseconds handlingTime);
+    void onIterationEnd(SessionContextData*);
+    void onTimer(SessionContextData*);
+    void updateTimer(SessionContextData*);
+    void setTimer(SessionContextData*, std::chrono::microseconds);
+    void startLoopLagSampling();
+    void scheduleLoopLagSample();
+    void sampleLoopLag();
+    void updateMediaSessions(SessionContextData*);
+    bool isOverloaded() const;
+    bool isRefused(SessionContextData*, const rtsp::Request&);
+    void checkDrained(SessionContextData*);
+    void drain(unsigned timeout, const Drained&);
+    void onDrained();
+    void resume();
+    void updateReceiveFlow(SessionContextData*);
+
+    bool write(SessionContextData*, PooledBuffer*);
+    bool writeMessages(SessionContextData*);
+    void popMessage(SessionData*);
+    bool isOverflowed(const SessionData&, unsigned scale = 1) const;
+    bool isDrained(const SessionData&) const;
+    void onOverflow(SessionContextData*);
+    void dropSupersededIceCandidates(SessionData*);
+    void enqueue(
+        SessionContextData*,
+        const MessageBufferPool::BufferPtr&,
+        const rtsp::SessionId&,
+        rtsp::MessagePriority,
+        MessageKind);
+    unsigned broadcast(rtsp::Request*, const BroadcastFilter&);
     void sendRequest(SessionContextData*, const rtsp::Request*);
     void sendResponse(SessionContextData*, const rtsp::Response*);
 
     bool onConnected(SessionContextData*);
+    void onDisconnected(SessionContextData*);
+
+    void dumpFlightRecorder(SessionContextData*, spdlog::level::level_enum);
 
     WsServer *const owner;
     Config config;
     GMainLoop* loop;
     CreateSession createSession;
 
+    // should be destroyed after contextPtr,
+    // since queued messages are released on connections close
+    MessageBufferPool bufferPool;
+
+    // should outlive SSL_CTX of secure vhost
+    TlsSessionResumption tlsSessionResumption;
+
     LwsContextPtr contextPtr;
+    lws_context* context = nullptr;
+    NativeLoop nativeLoop;
+
+    lws_vhost* unixSocketVhost = nullptr;
+    lws_vhost* secureUnixSocketVhost = nullptr;
+
+    std::unordered_map<const rtsp::Session*, SessionContextData*> connections;
+    std::unordered_map<std::string, unsigned> connectionsPerIp;
+
+    rtsp::CSeq nextBroadcastCSeq = BROADCAST_CSEQ_BASE;
+
+    std::chrono::microseconds loopLag { 0 };
+    std::chrono::steady_clock::time_point loopLagDeadline;
+    GSourcePtr loopLagSource; // EventLoop::GLib
+#if LWS_LIBRARY_VERSION_NUMBER >= 4000000
+    LoopLagTimer loopLagTimer {}; // EventLoop::Native
+#endif
+
+    // sum of SessionData::mediaSessions
+    unsigned mediaSessions = 0;
+
+    bool draining = false;
+    bool hasDrainDeadline = false;
+    std::chrono::steady_clock::time_point drainDeadline;
+    Drained drained;
+
+    Stats stats {};
 };
 
 WsServer::Private::Private(
@@ -78,16 +266,33 @@ WsServer::Private::Private(
     const Config& config,
     GMainLoop* loop,
     const WsServer::CreateSession& createSession) :
-    owner(owner), config(config), loop(loop), createSession(createSession)
+    owner(owner), config(config), loop(loop), createSession(createSession),
+    bufferPool(config.maxPooledBuffers),
+    tlsSessionResumption(config.tlsSessionResumption)
 {
 }
 
+WsServer::Private::~Private()
+{
+    if(loopLagSource)
+        g_source_destroy(loopLagSource.get());
+
+#if LWS_LIBRARY_VERSION_NUMBER >= 4000000
+    if(loopLagTimer.owner)
+        lws_sul_schedule(context, 0, &loopLagTimer.sul, nullptr, LWS_SET_TIMER_USEC_CANCEL);
+#endif
+}
+
 int WsServer::Private::httpCallback(
     lws* wsi,
     lws_callback_reasons reason,
     void* user, void* in, size_t len)
 {
     switch(reason) {
+        case LWS_CALLBACK_OPENSSL_LOAD_EXTRA_SERVER_VERIFY_CERTS:
+            if(!tlsSessionResumption.apply(user))
+                Log()->warn("Failed to enable TLS session resumption");
+            return 0;
         default:
             return lws_callback_http_dummy(wsi, reason, user, in, len);
     }
@@ -106,7 +311,26 @@ int WsServer::Private::wsCallback(
     switch (reason) {
         case LWS_CALLBACK_PROTOCOL_INIT:
             break;
+        case LWS_CALLBACK_CONFIRM_EXTENSION_OKAY:
+            if(scd && strcmp(static_cast<const char*>(in), "permessage-deflate") == 0)
+                scd->deflate = true;
+            break;
+        case LWS_CALLBACK_FILTER_PROTOCOL_CONNECTION:
+            if(draining) {
+                ++stats.rejectedConnections;
+                return -1;
+            }
+            break;
         case LWS_CALLBACK_ESTABLISHED: {
+            // checked only here, where connection is counted,
+            // since handshakes from the same ip could be in progress concurrently
+            std::string peerIp = PeerIp(wsi);
+            if(!isAdmissible(wsi, peerIp)) {
+                Log()->warn("Too many connections from {}. Rejecting...", peerIp);
+                ++stats.rejectedConnections;
+                return -1;
+            }
+
             std::unique_ptr<rtsp::Session> session =
                 createSession(
                     std::bind(&Private::sendRequest, this, scd, std::placeholders::_1),
@@ -114,14 +338,15 @@ int WsServer::Private::wsCallback(
             if(!session)
                 return -1;
 
-            scd->data =
-                new SessionData {
-                    .terminateSession = false,
-                    .incomingMessage ={},
-                    .sendMessages = {},
-                    .rtspSession = std::move(session)};
+            scd->data = new SessionData(config);
+            scd->data->rtspSession = std::move(session);
+            scd->data->peerIp = std::move(peerIp);
             scd->wsi = wsi;
 
+            connections.emplace(scd->data->rtspSession.get(), scd);
+            ++connectionsPerIp[scd->data->peerIp];
+            ++stats.connections;
+
             if(!onConnected(scd))
                 return -1;
 
@@ -129,48 +354,66 @@ int WsServer::Private::wsCallback(
         }
         case LWS_CALLBACK_RECEIVE_PONG:
             Log()->trace("PONG");
+            if(scd->data)
+                scd->data->rtt.onPong(in, len);
             break;
         case LWS_CALLBACK_RECEIVE: {
             if(scd->data->incomingMessage.onReceive(wsi, in, len)) {
-                if(Log()->level() <= spdlog::level::trace) {
-                    std::string logMessage;
-                    logMessage.reserve(scd->data->incomingMessage.size());
-                    std::remove_copy(
-                        scd->data->incomingMessage.data(),
-                        scd->data->incomingMessage.data() + scd->data->incomingMessage.size(),
-                        std::back_inserter(logMessage), '\r');
-
-                    Log()->trace("-> WsServer: {}", logMessage);
+                scd->data->flightRecorder.record(
+                    FlightRecorder::Direction::Incoming,
+                    scd->data->incomingMessage.data(),
+                    scd->data->incomingMessage.size());
+
+                if(!checkRateLimits(scd, scd->data->incomingMessage)) {
+                    ++stats.rateLimitedConnections;
+                    dumpFlightRecorder(scd, spdlog::level::warn);
+                    return -1;
                 }
 
-                if(!onMessage(scd, scd->data->incomingMessage))
+                const auto handlingStart = std::chrono::steady_clock::now();
+
+                const bool handled = onMessage(scd, scd->data->incomingMessage);
+                updateMediaSessions(scd);
+                if(!handled) {
+                    dumpFlightRecorder(scd, spdlog::level::warn);
                     return -1;
+                }
+
+                chargeBudget(
+                    scd,
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - handlingStart));
 
                 scd->data->incomingMessage.clear();
             }
 
             break;
         }
+        case LWS_CALLBACK_TIMER:
+            if(scd->data)
+                onTimer(scd);
+            break;
         case LWS_CALLBACK_SERVER_WRITEABLE: {
             if(scd->data->terminateSession)
                 return -1;
 
-            if(!scd->data->sendMessages.empty()) {
-                MessageBuffer& buffer = scd->data->sendMessages.front();
-                if(!buffer.writeAsText(wsi)) {
-                    Log()->error("write failed.");
+            if(scd->data->pingPending) {
+                scd->data->pingPending = false;
+                if(!scd->data->rtt.sendPing(wsi)) {
+                    Log()->error("ping write failed.");
                     return -1;
                 }
-
-                scd->data->sendMessages.pop_front();
-
-                if(!scd->data->sendMessages.empty())
-                    lws_callback_on_writable(wsi);
             }
 
+            if(!writeMessages(scd))
+                return -1;
+
             break;
         }
         case LWS_CALLBACK_CLOSED: {
+            if(scd->data)
+                onDisconnected(scd);
+
             delete scd->data;
             scd->data = nullptr;
 
@@ -202,6 +445,33 @@ bool WsServer::Private::init(lws_context* context)
             return p->wsCallback(wsi, reason, user, in, len);
         };
 
+    auto DeflateCallback =
+        [] (
+            lws_context* context,
+            const lws_extension* extension,
+            lws* wsi,
+            lws_extension_callback_reasons reason,
+            void* user, void* in, size_t len) -> int
+        {
+            lws_vhost* vhost = lws_get_vhost(wsi);
+            Private* p = static_cast<Private*>(lws_get_vhost_user(vhost));
+            SessionContextData* scd = static_cast<SessionContextData*>(lws_wsi_user(wsi));
+
+            return
+                DeflateExtensionCallback(
+                    scd ? &p->stats.deflate : nullptr,
+                    context, extension, wsi, reason, user, in, len);
+        };
+
+    static const lws_extension extensions[] = {
+        {
+            "permessage-deflate",
+            DeflateCallback,
+            "permessage-deflate; client_no_context_takeover; client_max_window_bits"
+        },
+        { nullptr, nullptr, nullptr } /* terminator */
+    };
+
     const lws_protocols protocols[] = {
         { "http", HttpCallback, 0, 0, HTTP_PROTOCOL_ID },
         {
@@ -240,8 +510,10 @@ bool WsServer::Private::init(lws_context* context)
         wsInfo.retry_and_idle_policy = &retryPolicy;
 #endif
         wsInfo.options = LWS_SERVER_OPTION_EXPLICIT_VHOSTS;
-        wsInfo.options |= LWS_SERVER_OPTION_GLIB;
-        wsInfo.foreign_loops = reinterpret_cast<void**>(&loop);
+        if(config.eventLoop == EventLoop::GLib) {
+            wsInfo.options |= LWS_SERVER_OPTION_GLIB;
+            wsInfo.foreign_loops = reinterpret_cast<void**>(&loop);
+        }
 
         contextPtr.reset(lws_create_context(&wsInfo));
         context = contextPtr.get();
@@ -249,12 +521,30 @@ bool WsServer::Private::init(lws_context* context)
     if(!context)
         return false;
 
-    if(config.port != 0) {
+    this->context = context;
+
+    if(!config.unixSocket.empty()) {
+        Log()->info("Starting WS server on unix socket {}", config.unixSocket);
+
+        lws_context_creation_info vhostInfo {};
+        vhostInfo.options |= LWS_SERVER_OPTION_UNIX_SOCK;
+        vhostInfo.iface = config.unixSocket.c_str();
+        vhostInfo.protocols = protocols;
+        if(config.permessageDeflate)
+            vhostInfo.extensions = extensions;
+        vhostInfo.user = this;
+
+        unixSocketVhost = lws_create_vhost(context, &vhostInfo);
+        if(!unixSocketVhost)
+             return false;
+    } else if(config.port != 0) {
         Log()->info("Starting WS server on port {}", config.port);
 
         lws_context_creation_info vhostInfo {};
         vhostInfo.port = config.port;
         vhostInfo.protocols = protocols;
+        if(config.permessageDeflate)
+            vhostInfo.extensions = extensions;
         vhostInfo.user = this;
         if(config.bindToLoopbackOnly)
             vhostInfo.iface = "lo";
@@ -264,35 +554,418 @@ bool WsServer::Private::init(lws_context* context)
              return false;
     }
 
-    if(!config.serverName.empty() && config.securePort != 0 &&
+    if(!config.serverName.empty() &&
+        (config.securePort != 0 || !config.secureUnixSocket.empty()) &&
         !config.certificate.empty() && !config.key.empty())
     {
-        Log()->info("Starting WSS server on port {}", config.securePort);
-
         lws_context_creation_info secureVhostInfo {};
-        secureVhostInfo.port = config.securePort;
+        if(!config.secureUnixSocket.empty()) {
+            Log()->info("Starting WSS server on unix socket {}", config.secureUnixSocket);
+
+            secureVhostInfo.options |= LWS_SERVER_OPTION_UNIX_SOCK;
+            secureVhostInfo.iface = config.secureUnixSocket.c_str();
+        } else {
+            Log()->info("Starting WSS server on port {}", config.securePort);
+
+            secureVhostInfo.port = config.securePort;
+            if(config.secureBindToLoopbackOnly)
+                secureVhostInfo.iface = "lo";
+        }
         secureVhostInfo.protocols = secureProtocols;
+        if(config.permessageDeflate)
+            secureVhostInfo.extensions = extensions;
         secureVhostInfo.ssl_cert_filepath = config.certificate.c_str();
         secureVhostInfo.ssl_private_key_filepath = config.key.c_str();
         secureVhostInfo.vhost_name = config.serverName.c_str();
         secureVhostInfo.options |= LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
         secureVhostInfo.user = this;
-        if(config.secureBindToLoopbackOnly)
-            secureVhostInfo.iface = "lo";
 
         lws_vhost* secureVhost = lws_create_vhost(context, &secureVhostInfo);
         if(!secureVhost)
              return false;
+
+        if(!config.secureUnixSocket.empty())
+            secureUnixSocketVhost = secureVhost;
     }
 
+    startLoopLagSampling();
+
     return true;
 }
 
 bool WsServer::Private::onConnected(SessionContextData* scd)
 {
+    if(config.rttPingInterval) {
+        // the first sample is taken right away to be available during session setup
+        scd->data->nextPingTime = RttEstimator::Clock::now();
+        onTimer(scd);
+    }
+
     return scd->data->rtspSession->onConnected();
 }
 
+void WsServer::Private::onDisconnected(SessionContextData* scd)
+{
+    SessionData& data = *scd->data;
+
+    connections.erase(data.rtspSession.get());
+
+    auto it = connectionsPerIp.find(data.peerIp);
+    if(it != connectionsPerIp.end() && 0 == --it->second)
+        connectionsPerIp.erase(it);
+
+    --stats.connections;
+    mediaSessions -= data.mediaSessions;
+    stats.queuedMessages -= static_cast<unsigned>(data.messagesToSendCount());
+    stats.queuedBytes -= data.sendBytes;
+    if(data.receivePaused)
+        --stats.pausedConnections;
+
+    if(draining && connections.empty())
+        onDrained();
+}
+
+// draining stays on until resume(),
+// so connections are still refused after that
+void WsServer::Private::onDrained()
+{
+    Log()->info("Drained.");
+
+    Drained drained;
+    drained.swap(this->drained);
+    if(drained)
+        drained();
+}
+
+bool WsServer::Private::isUnixSocketConnection(lws* wsi) const
+{
+    lws_vhost* vhost = lws_get_vhost(wsi);
+
+    return
+        (unixSocketVhost && vhost == unixSocketVhost) ||
+        (secureUnixSocketVhost && vhost == secureUnixSocketVhost);
+}
+
+bool WsServer::Private::isAdmissible(lws* wsi, const std::string& peerIp) const
+{
+    // all connections through unix socket come from the same local proxy
+    if(!config.maxConnectionsPerIp || isUnixSocketConnection(wsi))
+        return true;
+
+    auto it = connectionsPerIp.find(peerIp);
+
+    return it == connectionsPerIp.end() || it->second < config.maxConnectionsPerIp;
+}
+
+// applied before message parsing
+bool WsServer::Private::checkRateLimits(
+    SessionContextData* scd,
+    const MessageBuffer& message)
+{
+    SessionData& data = *scd->data;
+
+    const TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+
+    if(!data.messagesBucket.consume(now)) {
+        Log()->warn("Messages rate limit exceeded by {}. Forcing session disconnect...", data.peerIp);
+        return false;
+    }
+
+    if(IsPeerCreatingRequest(message) && !data.peerCreationsBucket.consume(now)) {
+        Log()->warn("DESCRIBE/ANNOUNCE rate limit exceeded by {}. Forcing session disconnect...", data.peerIp);
+        return false;
+    }
+
+    return true;
+}
+
+void WsServer::Private::chargeBudget(
+    SessionContextData* scd,
+    std::chrono::microseconds handlingTime)
+{
+    if(!config.maxMessagesPerIteration && !config.maxHandlingTimePerIteration)
+        return;
+
+    SessionData& data = *scd->data;
+
+    // the first message of iteration, schedule budget reset on the next one
+    if(0 == data.iterationMessages++)
+        setTimer(scd, std::chrono::microseconds(1));
+
+    data.iterationHandlingTime += handlingTime;
+
+    const bool exhausted =
+        (config.maxMessagesPerIteration &&
+            data.iterationMessages >= config.maxMessagesPerIteration) ||
+        (config.maxHandlingTimePerIteration &&
+            data.iterationHandlingTime.count() >= config.maxHandlingTimePerIteration);
+    if(exhausted && !data.receiveThrottled) {
+        data.receiveThrottled = true;
+        ++stats.throttledIterations;
+        updateReceiveFlow(scd);
+    }
+}
+
+void WsServer::Private::onIterationEnd(SessionContextData* scd)
+{
+    SessionData& data = *scd->data;
+
+    data.iterationMessages = 0;
+    data.iterationHandlingTime = std::chrono::microseconds::zero();
+
+    if(data.receiveThrottled) {
+        data.receiveThrottled = false;
+        updateReceiveFlow(scd);
+    }
+}
+
+// single lws timer per connection is shared by processing budget reset,
+// pings and drain checks
+void WsServer::Private::onTimer(SessionContextData* scd)
+{
+    SessionData& data = *scd->data;
+
+    data.timerDeadline = std::chrono::steady_clock::time_point();
+
+    onIterationEnd(scd);
+
+    if(config.rttPingInterval && RttEstimator::Clock::now() >= data.nextPingTime) {
+        data.pingPending = true;
+        data.nextPingTime =
+            RttEstimator::Clock::now() + std::chrono::seconds(config.rttPingInterval);
+        lws_callback_on_writable(scd->wsi);
+    }
+
+    if(draining)
+        checkDrained(scd);
+
+    updateTimer(scd);
+}
+
+void WsServer::Private::updateTimer(SessionContextData* scd)
+{
+    const SessionData& data = *scd->data;
+
+    const RttEstimator::Clock::time_point now = RttEstimator::Clock::now();
+
+    RttEstimator::Clock::time_point next = RttEstimator::Clock::time_point::max();
+    if(config.rttPingInterval)
+        next = data.nextPingTime;
+    if(draining)
+        next = std::min(next, now + std::chrono::seconds(DRAIN_CHECK_INTERVAL));
+
+    if(next == RttEstimator::Clock::time_point::max())
+        return;
+
+    // already scheduled timer (f.e. processing budget reset) fires earlier
+    // and reschedules the rest itself
+    if(data.timerDeadline != std::chrono::steady_clock::time_point() &&
+        data.timerDeadline <= next)
+    {
+        return;
+    }
+
+    setTimer(scd, std::chrono::duration_cast<std::chrono::microseconds>(next - now));
+}
+
+void WsServer::Private::setTimer(
+    SessionContextData* scd,
+    std::chrono::microseconds timeout)
+{
+    scd->data->timerDeadline = std::chrono::steady_clock::now() + timeout;
+
+    lws_set_timer_usecs(scd->wsi, timeout.count());
+}
+
+// loop lag is sampled as delay of dedicated periodic timer
+void WsServer::Private::startLoopLagSampling()
+{
+    if(config.eventLoop == EventLoop::GLib) {
+        GMainContext* mainContext =
+            loop ? g_main_loop_get_context(loop) : g_main_context_get_thread_default();
+
+        loopLagSource.reset(g_timeout_source_new(LOOP_LAG_SAMPLE_INTERVAL));
+        g_source_set_callback(
+            loopLagSource.get(),
+            [] (gpointer userData) -> gboolean {
+                static_cast<Private*>(userData)->sampleLoopLag();
+                return G_SOURCE_CONTINUE;
+            }, this, nullptr);
+        g_source_attach(loopLagSource.get(), mainContext);
+    } else {
+#if LWS_LIBRARY_VERSION_NUMBER >= 4000000
+        loopLagTimer.owner = this;
+#else
+        Log()->warn("Loop lag is not measured with native loop of libwebsockets < 4.0");
+        return;
+#endif
+    }
+
+    scheduleLoopLagSample();
+}
+
+void WsServer::Private::scheduleLoopLagSample()
+{
+    loopLagDeadline =
+        std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(LOOP_LAG_SAMPLE_INTERVAL);
+
+#if LWS_LIBRARY_VERSION_NUMBER >= 4000000
+    if(loopLagTimer.owner) {
+        lws_sul_schedule(
+            context, 0, &loopLagTimer.sul,
+            [] (lws_sorted_usec_list_t* sul) {
+                reinterpret_cast<LoopLagTimer*>(sul)->owner->sampleLoopLag();
+            },
+            LOOP_LAG_SAMPLE_INTERVAL * 1000);
+    }
+#endif
+}
+
+void WsServer::Private::sampleLoopLag()
+{
+    const auto lag =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - loopLagDeadline);
+    loopLag +=
+        (std::max(lag, std::chrono::microseconds::zero()) - loopLag) /
+        (1 << LOOP_LAG_SMOOTHING_SHIFT);
+
+    scheduleLoopLagSample();
+}
+
+// media sessions of connection could appear or go away
+// only while it handles or sends messages
+void WsServer::Private::updateMediaSessions(SessionContextData* scd)
+{
+    SessionData& data = *scd->data;
+    if(!data.rtspSession)
+        return;
+
+    const unsigned count = data.rtspSession->mediaSessionsCount();
+
+    mediaSessions = mediaSessions - data.mediaSessions + count;
+    data.mediaSessions = count;
+}
+
+bool WsServer::Private::isOverloaded() const
+{
+    if(config.maxLoopLag && loopLag.count() > config.maxLoopLag)
+        return true;
+
+    if(config.maxMediaSessions && mediaSessions >= config.maxMediaSessions)
+        return true;
+
+    return false;
+}
+
+// i.e. DESCRIBE or ANNOUNCE answered with 503 instead of peer creation
+bool WsServer::Private::isRefused(
+    SessionContextData* scd,
+    const rtsp::Request& request)
+{
+    if(request.method != rtsp::Method::DESCRIBE && request.method != rtsp::Method::ANNOUNCE)
+        return false;
+
+    const bool overloaded = !draining && isOverloaded();
+    if(!draining && !overloaded)
+        return false;
+
+    rtsp::Response response;
+    response.protocol = rtsp::Protocol::WEBRTSP_0_1;
+    response.cseq = request.cseq;
+    response.statusCode = rtsp::SERVICE_UNAVAILABLE;
+    response.reasonPhrase = "Service Unavailable";
+
+    // it makes no sense to retry on draining server
+    if(overloaded) {
+        Log()->debug("Server is overloaded. Refusing {}...", rtsp::MethodName(request.method));
+
+        ++stats.overloadRejections;
+        if(config.retryAfter)
+            response.headerFields.emplace("Retry-After", std::to_string(config.retryAfter));
+    }
+
+    sendResponse(scd, &response);
+
+    return true;
+}
+
+void WsServer::Private::checkDrained(SessionContextData* scd)
+{
+    SessionData& data = *scd->data;
+    if(data.terminateSession)
+        return;
+
+    updateMediaSessions(scd);
+    if(data.mediaSessions &&
+        (!hasDrainDeadline || std::chrono::steady_clock::now() < drainDeadline))
+    {
+        return;
+    }
+
+    if(data.mediaSessions) {
+        Log()->info(
+            "Drain timeout. Closing connection with {} media sessions...",
+            data.mediaSessions);
+    }
+
+    data.terminateSession = true;
+    lws_callback_on_writable(scd->wsi);
+}
+
+void WsServer::Private::drain(unsigned timeout, const Drained& drained)
+{
+    draining = true;
+    hasDrainDeadline = timeout != 0;
+    drainDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+    this->drained = drained;
+
+    Log()->info(
+        "Draining {} connections with {} media sessions...",
+        connections.size(), mediaSessions);
+
+    if(connections.empty()) {
+        onDrained();
+        return;
+    }
+
+    for(const auto& pair: connections) {
+        checkDrained(pair.second);
+        updateTimer(pair.second);
+    }
+}
+
+void WsServer::Private::resume()
+{
+    if(!draining)
+        return;
+
+    Log()->info("Resuming...");
+
+    draining = false;
+    hasDrainDeadline = false;
+    drained = nullptr;
+}
+
+void WsServer::Private::updateReceiveFlow(SessionContextData* scd)
+{
+    const SessionData& data = *scd->data;
+
+    lws_rx_flow_control(scd->wsi, data.receivePaused || data.receiveThrottled ? 0 : 1);
+}
+
+void WsServer::Private::dumpFlightRecorder(
+    SessionContextData* scd,
+    spdlog::level::level_enum level)
+{
+    if(Log()->level() > level)
+        return;
+
+    Log()->log(level, "Session with {} history:", scd->data->peerIp);
+    scd->data->flightRecorder.dump(*Log(), level);
+}
+
 bool WsServer::Private::onMessage(
     SessionContextData* scd,
     const MessageBuffer& message)
@@ -305,6 +978,9 @@ bool WsServer::Private::onMessage(
             return false;
         }
 
+        if(isRefused(scd, *requestPtr))
+            return true;
+
         if(!scd->data->rtspSession->handleRequest(requestPtr)) {
             Log()->debug("Fail handle request. Forcing session disconnect...");
             return false;
@@ -317,6 +993,12 @@ bool WsServer::Private::onMessage(
             return false;
         }
 
+        if(responsePtr->cseq >= BROADCAST_CSEQ_BASE) {
+            if(responsePtr->statusCode != rtsp::OK)
+                Log()->debug("Broadcasted request failed with {}.", responsePtr->statusCode);
+            return true;
+        }
+
         if(!scd->data->rtspSession->handleResponse(responsePtr)) {
             Log()->error("Fail handle response. Forcing session disconnect...");
             return false;
@@ -326,41 +1008,269 @@ bool WsServer::Private::onMessage(
     return true;
 }
 
-void WsServer::Private::send(SessionContextData* scd, MessageBuffer* message)
+bool WsServer::Private::write(SessionContextData* scd, PooledBuffer* buffer)
 {
-    scd->data->sendMessages.emplace_back(std::move(*message));
+    if(scd->deflate) {
+        ++stats.deflate.deflatedMessages;
+        stats.deflate.deflatedBytes += buffer->size();
+    }
+
+    return buffer->writeAsText(scd->wsi);
+}
+
+bool WsServer::Private::writeMessages(SessionContextData* scd)
+{
+    SessionData& data = *scd->data;
+
+    unsigned written = 0;
+    while(data.hasMessagesToSend()) {
+        PooledBuffer& buffer = *data.nextMessages().front().buffer;
+        if(!write(scd, &buffer)) {
+            Log()->error("write failed.");
+            dumpFlightRecorder(scd, spdlog::level::warn);
+            return false;
+        }
+
+        popMessage(&data);
+        ++written;
+
+        if(data.receivePaused && isDrained(data)) {
+            data.receivePaused = false;
+            --stats.pausedConnections;
+            updateReceiveFlow(scd);
+        }
+
+        if(!data.hasMessagesToSend())
+            break;
+
+        if(written >= config.maxMessagesPerWriteable || lws_send_pipe_choked(scd->wsi)) {
+            lws_callback_on_writable(scd->wsi);
+            break;
+        }
+    }
+
+    return true;
+}
+
+void WsServer::Private::popMessage(SessionData* data)
+{
+    std::deque<OutgoingMessage>& messages = data->nextMessages();
+    const size_t size = messages.front().buffer->size();
+
+    messages.pop_front();
+    data->sendBytes -= size;
+
+    --stats.queuedMessages;
+    stats.queuedBytes -= size;
+}
+
+bool WsServer::Private::isOverflowed(const SessionData& data, unsigned scale) const
+{
+    return
+        (config.maxOutboundMessages &&
+            data.messagesToSendCount() > config.maxOutboundMessages * scale) ||
+        (config.maxOutboundBytes &&
+            data.sendBytes > config.maxOutboundBytes * scale);
+}
+
+// i.e. queue is below half of limits
+bool WsServer::Private::isDrained(const SessionData& data) const
+{
+    return
+        (!config.maxOutboundMessages ||
+            data.messagesToSendCount() <= config.maxOutboundMessages / 2) &&
+        (!config.maxOutboundBytes ||
+            data.sendBytes <= config.maxOutboundBytes / 2);
+}
+
+// i.e. ICE candidates queued before TEARDOWN or new SDP of the same session
+void WsServer::Private::dropSupersededIceCandidates(SessionData* data)
+{
+    std::unordered_map<rtsp::SessionId, unsigned long long> lastResets;
+    for(std::deque<OutgoingMessage>* messages:
+        { &data->prioritySendMessages, &data->sendMessages })
+    {
+        for(const OutgoingMessage& message: *messages) {
+            if(message.kind != MessageKind::IceReset || message.session.empty())
+                continue;
+
+            unsigned long long& lastReset = lastResets[message.session];
+            lastReset = std::max(lastReset, message.sequence);
+        }
+    }
+
+    if(lastResets.empty())
+        return;
+
+    for(std::deque<OutgoingMessage>* messages:
+        { &data->prioritySendMessages, &data->sendMessages })
+    {
+        auto it = messages->begin();
+        while(it != messages->end()) {
+            auto resetIt =
+                it->kind == MessageKind::IceCandidate ?
+                    lastResets.find(it->session) :
+                    lastResets.end();
+            if(resetIt != lastResets.end() && it->sequence < resetIt->second) {
+                const size_t size = it->buffer->size();
+
+                it = messages->erase(it);
+                data->sendBytes -= size;
+
+                --stats.queuedMessages;
+                stats.queuedBytes -= size;
+                ++stats.droppedMessages;
+            } else
+                ++it;
+        }
+    }
+}
+
+void WsServer::Private::onOverflow(SessionContextData* scd)
+{
+    SessionData& data = *scd->data;
+
+    switch(config.overflowPolicy) {
+        case OverflowPolicy::DropIceCandidates:
+            dropSupersededIceCandidates(&data);
+            if(!isOverflowed(data))
+                return;
+            break;
+        case OverflowPolicy::PauseReceiving:
+            if(!data.receivePaused) {
+                Log()->debug(
+                    "Outbound queue overflow ({} messages, {} bytes). Pausing receive...",
+                    data.messagesToSendCount(), data.sendBytes);
+
+                data.receivePaused = true;
+                ++stats.pausedConnections;
+                updateReceiveFlow(scd);
+            }
+
+            // server originated messages (ICE candidates, broadcasts)
+            // keep coming even with paused receive
+            if(!isOverflowed(data, PAUSED_OVERFLOW_SCALE))
+                return;
+            break;
+        case OverflowPolicy::Disconnect:
+            break;
+    }
+
+    Log()->warn(
+        "Outbound queue overflow ({} messages, {} bytes). Forcing session disconnect...",
+        data.messagesToSendCount(), data.sendBytes);
+
+    ++stats.overflowDisconnects;
+    data.terminateSession = true;
+
+    dumpFlightRecorder(scd, spdlog::level::warn);
+}
+
+// the same buffer could be queued to many connections,
+// it's safe since payload is never modified on write
+void WsServer::Private::enqueue(
+    SessionContextData* scd,
+    const MessageBufferPool::BufferPtr& buffer,
+    const rtsp::SessionId& session,
+    rtsp::MessagePriority priority,
+    MessageKind kind)
+{
+    SessionData& data = *scd->data;
+    if(data.terminateSession)
+        return;
+
+    const bool prioritize =
+        rtsp::CanPrioritize(priority, session, data.sendMessages);
+
+    data.flightRecorder.record(
+        FlightRecorder::Direction::Outgoing,
+        buffer->data(), buffer->size());
+
+    const size_t size = buffer->size();
+    (prioritize ? data.prioritySendMessages : data.sendMessages).emplace_back(
+        OutgoingMessage {
+            .buffer = buffer,
+            .session = session,
+            .kind = kind,
+            .sequence = data.nextMessageSequence++ });
+    data.sendBytes += size;
+
+    ++stats.queuedMessages;
+    stats.queuedBytes += size;
+
+    if(isOverflowed(data))
+        onOverflow(scd);
 
     lws_callback_on_writable(scd->wsi);
 }
 
+unsigned WsServer::Private::broadcast(
+    rtsp::Request* request,
+    const BroadcastFilter& filter)
+{
+    request->cseq = nextBroadcastCSeq++;
+    if(nextBroadcastCSeq < BROADCAST_CSEQ_BASE)
+        nextBroadcastCSeq = BROADCAST_CSEQ_BASE;
+
+    unsigned recipients = 0;
+    try {
+        MessageBufferPool::BufferPtr buffer = bufferPool.acquire();
+        rtsp::Serialize(*request, buffer->payloadBuffer());
+        if(buffer->empty())
+            return 0;
+
+        const rtsp::MessagePriority priority = rtsp::RequestPriority(*request);
+
+        for(const auto& pair: connections) {
+            if(pair.second->data->terminateSession)
+                continue;
+
+            if(filter && !filter(*pair.first))
+                continue;
+
+            enqueue(pair.second, buffer, rtsp::SessionId(), priority, MessageKind::Other);
+            ++recipients;
+        }
+    } catch(...) {
+        Log()->error("Broadcast failed after {} connections.", recipients);
+    }
+
+    ++stats.broadcasts;
+    stats.broadcastRecipients += recipients;
+
+    Log()->debug("Request broadcasted to {} connections.", recipients);
+
+    return recipients;
+}
+
 void WsServer::Private::sendRequest(
     SessionContextData* scd,
     const rtsp::Request* request)
 {
+    updateMediaSessions(scd);
+
     if(!request) {
         scd->data->terminateSession = true;
+        dumpFlightRecorder(scd, spdlog::level::info);
         lws_callback_on_writable(scd->wsi);
         return;
     }
 
-    const std::string serializedRequest = rtsp::Serialize(*request);
-    if(serializedRequest.empty()) {
+    if(scd->data->terminateSession)
+        return;
+
+    MessageBufferPool::BufferPtr buffer = bufferPool.acquire();
+    rtsp::Serialize(*request, buffer->payloadBuffer());
+    if(buffer->empty()) {
         scd->data->terminateSession = true;
         lws_callback_on_writable(scd->wsi);
     } else {
-        if(Log()->level() <= spdlog::level::trace) {
-            std::string logMessage;
-            logMessage.reserve(serializedRequest.size());
-            std::remove_copy(
-                serializedRequest.begin(),
-                serializedRequest.end(),
-                std::back_inserter(logMessage), '\r');
-            Log()->trace("WsServer -> : {}", logMessage);
-        }
-
-        MessageBuffer requestMessage;
-        requestMessage.assign(serializedRequest);
-        send(scd, &requestMessage);
+        enqueue(
+            scd,
+            buffer,
+            rtsp::OutgoingRequestSession(*request),
+            rtsp::RequestPriority(*request),
+            RequestKind(*request));
     }
 }
 
@@ -368,30 +1278,29 @@ void WsServer::Private::sendResponse(
     SessionContextData* scd,
     const rtsp::Response* response)
 {
+    updateMediaSessions(scd);
+
     if(!response) {
         scd->data->terminateSession = true;
         lws_callback_on_writable(scd->wsi);
         return;
     }
 
-    const std::string serializedResponse = rtsp::Serialize(*response);
-    if(serializedResponse.empty()) {
+    if(scd->data->terminateSession)
+        return;
+
+    MessageBufferPool::BufferPtr buffer = bufferPool.acquire();
+    rtsp::Serialize(*response, buffer->payloadBuffer());
+    if(buffer->empty()) {
         scd->data->terminateSession = true;
         lws_callback_on_writable(scd->wsi);
     } else {
-        if(Log()->level() <= spdlog::level::trace) {
-            std::string logMessage;
-            logMessage.reserve(serializedResponse.size());
-            std::remove_copy(
-                serializedResponse.begin(),
-                serializedResponse.end(),
-                std::back_inserter(logMessage), '\r');
-            Log()->trace("WsServer -> : {}", logMessage);
-        }
-
-        MessageBuffer responseMessage;
-        responseMessage.assign(serializedResponse);
-        send(scd, &responseMessage);
+        enqueue(
+            scd,
+            buffer,
+            rtsp::OutgoingResponseSession(*response),
+            rtsp::ResponsePriority(*response),
+            ResponseKind(*response));
     }
 }
 
@@ -412,4 +1321,79 @@ bool WsServer::init(lws_context* context /*= nullptr*/) noexcept
     return _p->init(context);
 }
 
+RttEstimator::Estimate WsServer::rtt(const rtsp::Session& session) const noexcept
+{
+    auto it = _p->connections.find(&session);
+    if(it == _p->connections.end())
+        return RttEstimator::Estimate {};
+
+    return it->second->data->rtt.estimate();
+}
+
+void WsServer::dumpFlightRecorder(const rtsp::Session& session) const noexcept
+{
+    auto it = _p->connections.find(&session);
+    if(it != _p->connections.end())
+        _p->dumpFlightRecorder(it->second, spdlog::level::info);
+}
+
+void WsServer::run() noexcept
+{
+    if(_p->context)
+        _p->nativeLoop.run(_p->context);
+}
+
+void WsServer::stop() noexcept
+{
+    if(_p->context)
+        _p->nativeLoop.stop(_p->context);
+}
+
+void WsServer::drain(unsigned timeout, const Drained& drained) noexcept
+{
+    _p->drain(timeout, drained);
+}
+
+void WsServer::resume() noexcept
+{
+    _p->resume();
+}
+
+unsigned WsServer::broadcast(
+    rtsp::Request* request,
+    const BroadcastFilter& filter /*= BroadcastFilter()*/) noexcept
+{
+    return _p->broadcast(request, filter);
+}
+
+WsServer::Stats WsServer::stats() const noexcept
+{
+    Stats stats = _p->stats;
+    stats.pooledBuffers = _p->bufferPool.pooled();
+    stats.fullTlsHandshakes = _p->tlsSessionResumption.fullHandshakes();
+    stats.resumedTlsHandshakes = _p->tlsSessionResumption.resumedHandshakes();
+    stats.draining = _p->draining;
+    stats.loopLag = _p->loopLag.count();
+    stats.mediaSessions = _p->mediaSessions;
+
+    unsigned long long rttSum = 0;
+    unsigned long long jitterSum = 0;
+    for(const auto& pair: _p->connections) {
+        const RttEstimator::Estimate& rtt = pair.second->data->rtt.estimate();
+        if(!rtt.samples)
+            continue;
+
+        ++stats.rttConnections;
+        rttSum += rtt.smoothed;
+        jitterSum += rtt.jitter;
+        stats.maxRtt = std::max(stats.maxRtt, rtt.smoothed);
+    }
+    if(stats.rttConnections) {
+        stats.averageRtt = rttSum / stats.rttConnections;
+        stats.averageRttJitter = jitterSum / stats.rttConnections;
+    }
+
+    return stats;
+}
+
 }
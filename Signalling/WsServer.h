@@ -7,6 +7,8 @@
 #include <glib.h>
 
 #include "RtspSession/ServerSession.h"
+#include "Common/RttEstimator.h"
+#include "Common/DeflateExtension.h"
 
 #include "Config.h"
 
@@ -23,10 +25,81 @@ public:
             const std::function<void (const rtsp::Request*)>& sendRequest,
             const std::function<void (const rtsp::Response*)>& sendResponse) noexcept> CreateSession;
 
+    typedef std::function<bool (const rtsp::Session&)> BroadcastFilter;
+
+    typedef std::function<void () noexcept> Drained;
+
+    struct Stats
+    {
+        unsigned connections;
+        unsigned queuedMessages;
+        size_t queuedBytes;
+        unsigned pausedConnections;
+        unsigned pooledBuffers;
+        unsigned long long droppedMessages;
+        unsigned long long overflowDisconnects;
+
+        DeflateStats deflate;
+
+        unsigned long long rejectedConnections;
+        unsigned long long rateLimitedConnections;
+
+        unsigned long long throttledIterations;
+
+        // over connections having at least one RTT sample
+        unsigned rttConnections;
+        unsigned long long averageRtt; // microseconds
+        unsigned long long maxRtt; // microseconds
+        unsigned long long averageRttJitter; // microseconds
+
+        unsigned long long broadcasts;
+        unsigned long long broadcastRecipients;
+
+        unsigned long long fullTlsHandshakes;
+        unsigned long long resumedTlsHandshakes;
+
+        bool draining;
+        unsigned mediaSessions;
+
+        unsigned long long loopLag; // microseconds, smoothed
+        unsigned long long overloadRejections;
+    };
+
+    // GMainLoop could be nullptr with EventLoop::Native
     WsServer(const Config&, GMainLoop*, const CreateSession&) noexcept;
     bool init(lws_context* = nullptr) noexcept;
     ~WsServer();
 
+    // EventLoop::Native only
+    void run() noexcept;
+    void stop() noexcept;
+
+    Stats stats() const noexcept;
+
+    // Stops accepting new connections and answers DESCRIBE/ANNOUNCE
+    // on existing ones with 503 Service Unavailable.
+    // Connections are closed as soon as they have no media sessions,
+    // the rest is closed on timeout (seconds, 0 - no timeout).
+    // Drained is called when the last connection is closed,
+    // new connections are refused until resume().
+    void drain(unsigned timeout, const Drained&) noexcept;
+    // Cancels drain, connections already closed are not restored.
+    void resume() noexcept;
+
+    // Serializes request only once and queues the same buffer
+    // to every connection accepted by filter (to all connections if filter is empty).
+    // CSeq is assigned by WsServer and responses are consumed by WsServer,
+    // so request shouldn't be bound to RTSP session.
+    // Returns recipients count.
+    unsigned broadcast(
+        rtsp::Request*,
+        const BroadcastFilter& = BroadcastFilter()) noexcept;
+
+    // all zeroes if there is no RTT sample yet
+    RttEstimator::Estimate rtt(const rtsp::Session&) const noexcept;
+
+    void dumpFlightRecorder(const rtsp::Session&) const noexcept;
+
 private:
     struct Private;
     std::unique_ptr<Private> _p;